@@ -0,0 +1,150 @@
+/**
+ * @file aesd-arena-buffer.c
+ * @brief Circular buffer of entries stored back to back in a single arena
+ *
+ * Any necessary locking must be performed by the caller of every function.
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
+#include "aesd-arena-buffer.h"
+
+/**
+ * @return the location of the byte at @param offset in the arena of
+ * @param buffer
+ */
+static size_t aesd_arena_buffer_index(const struct aesd_arena_buffer *buffer,
+                                      uint64_t offset) {
+  return offset & (buffer->data_size - 1);
+}
+
+/**
+ * Initializes @param buffer to an empty buffer storing its entries in the
+ * @param data_size bytes at @param data, which must outlive it.
+ * @return false if @param data_size is not a power of two
+ */
+bool aesd_arena_buffer_init(struct aesd_arena_buffer *buffer, char *data,
+                            size_t data_size) {
+  if (!AESD_RING_IS_POWER_OF_2(data_size)) {
+    return false;
+  }
+
+  memset(buffer, 0, sizeof(struct aesd_arena_buffer));
+  buffer->data = data;
+  buffer->data_size = data_size;
+  return true;
+}
+
+/**
+ * Copies the @param size bytes at @param bytes to @param buffer as its newest
+ * entry, first evicting as many of the oldest entries as needed to make room
+ * for them and for their descriptor.
+ * @return false, leaving @param buffer unchanged, if @param size is larger than
+ * the whole arena
+ */
+bool aesd_arena_buffer_add_entry(struct aesd_arena_buffer *buffer,
+                                 const char *bytes, size_t size) {
+  if (size > buffer->data_size) {
+    return false;
+  }
+
+  while (buffer->head + size - buffer->tail > buffer->data_size) {
+    aesd_arena_ring_pop(buffer);
+    buffer->tail = aesd_arena_buffer_count(buffer)
+                       ? aesd_arena_ring_at(buffer, 0)->offset
+                       : buffer->head;
+  }
+
+  size_t const index = aesd_arena_buffer_index(buffer, buffer->head);
+  size_t const first = buffer->data_size - index < size
+                           ? buffer->data_size - index
+                           : size;
+  memcpy(buffer->data + index, bytes, first);
+  memcpy(buffer->data, bytes + first, size - first);
+
+  struct aesd_arena_entry const entry = {.offset = buffer->head, .size = size};
+  struct aesd_arena_entry dropped;
+  if (aesd_arena_ring_push(buffer, &entry, &dropped)) {
+    buffer->tail = aesd_arena_ring_at(buffer, 0)->offset;
+  }
+  buffer->head += size;
+  ++(buffer->total_entries);
+
+  return true;
+}
+
+/**
+ * @return the number of entries stored in @param buffer
+ */
+size_t aesd_arena_buffer_count(const struct aesd_arena_buffer *buffer) {
+  return aesd_arena_ring_count(buffer);
+}
+
+/**
+ * @return the sequence number of the oldest entry of @param buffer, or the one
+ * the next entry will get when empty
+ */
+uint64_t aesd_arena_buffer_first_seq(const struct aesd_arena_buffer *buffer) {
+  return buffer->total_entries - aesd_arena_buffer_count(buffer);
+}
+
+/**
+ * Same as aesd_circular_buffer_find_entry_for_offset for @param buffer.
+ * @return the descriptor of the entry holding @param offset, or NULL if that
+ * byte was evicted or not written yet.
+ */
+const struct aesd_arena_entry *
+aesd_arena_buffer_find_entry_for_offset(const struct aesd_arena_buffer *buffer,
+                                        uint64_t offset,
+                                        size_t *entry_offset_byte_rtn) {
+  if (offset < buffer->tail || offset >= buffer->head) {
+    return NULL;
+  }
+
+  // last entry, from the oldest, starting at or before offset
+  size_t low = 0;
+  size_t high = aesd_arena_buffer_count(buffer) - 1;
+  while (low < high) {
+    size_t const mid = low + (high - low + 1) / 2;
+    if (buffer->entry[aesd_arena_ring_index(buffer, mid)].offset <= offset) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  const struct aesd_arena_entry *entry =
+      &buffer->entry[aesd_arena_ring_index(buffer, low)];
+  *entry_offset_byte_rtn = offset - entry->offset;
+  return entry;
+}
+
+/**
+ * Copies to @param dest up to @param count bytes of @param buffer starting at
+ * @param offset, a position in the stream of every byte ever added, across as
+ * many consecutive entries as they span.
+ * @return the number of bytes copied, 0 if @param offset was evicted or not
+ * written yet
+ */
+size_t aesd_arena_buffer_copy(const struct aesd_arena_buffer *buffer,
+                              uint64_t offset, char *dest, size_t count) {
+  if (offset < buffer->tail || offset >= buffer->head) {
+    return 0;
+  }
+
+  if (count > buffer->head - offset) {
+    count = buffer->head - offset;
+  }
+
+  size_t const index = aesd_arena_buffer_index(buffer, offset);
+  size_t const first =
+      buffer->data_size - index < count ? buffer->data_size - index : count;
+  memcpy(dest, buffer->data + index, first);
+  memcpy(dest + first, buffer->data, count - first);
+
+  return count;
+}
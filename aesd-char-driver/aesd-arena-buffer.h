@@ -0,0 +1,94 @@
+/*
+ * aesd-arena-buffer.h
+ *
+ * Circular buffer storing the bytes of its entries back to back in one
+ * preallocated arena, instead of pointing to a separate allocation per entry
+ * like aesd_circular_buffer. Entries are (offset, size) descriptors, evicting
+ * one only advances the tail, and consecutive entries are read with at most
+ * two copies.
+ */
+
+#ifndef AESD_ARENA_BUFFER_H
+#define AESD_ARENA_BUFFER_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#endif
+
+#include "aesd-ring.h"
+
+/*
+** Number of entry descriptors of the buffer, a power of two
+*/
+#ifndef AESDCHAR_ARENA_MAX_ENTRIES
+#define AESDCHAR_ARENA_MAX_ENTRIES 64
+#endif
+
+struct aesd_arena_entry {
+  /**
+   * Position of the first byte of the entry in the stream of every byte ever
+   * added, stored in the arena at offset modulo the arena size
+   */
+  uint64_t offset;
+  /**
+   * Number of bytes in the entry. An entry running past the end of the arena
+   * continues at its start
+   */
+  size_t size;
+};
+
+struct aesd_arena_buffer {
+  /**
+   * Descriptors of the stored entries, oldest at out_offs
+   */
+  AESD_RING_FIELDS(struct aesd_arena_entry, AESDCHAR_ARENA_MAX_ENTRIES);
+  /*
+  ** The arena, allocated and released by the caller
+  */
+  char *data;
+  /*
+  ** Size of data, a power of two
+  */
+  size_t data_size;
+  /*
+  ** Number of bytes ever added, the position one past the newest entry
+  */
+  uint64_t head;
+  /*
+  ** Position of the first byte of the oldest entry, equal to head when empty
+  */
+  uint64_t tail;
+  /*
+  ** Number of entries ever added, the sequence number of the next entry
+  */
+  uint64_t total_entries;
+};
+
+AESD_RING_DEFINE(aesd_arena_ring, struct aesd_arena_buffer,
+                 struct aesd_arena_entry, AESDCHAR_ARENA_MAX_ENTRIES)
+
+extern bool aesd_arena_buffer_init(struct aesd_arena_buffer *buffer,
+                                   char *data, size_t data_size);
+
+extern bool aesd_arena_buffer_add_entry(struct aesd_arena_buffer *buffer,
+                                        const char *bytes, size_t size);
+
+extern size_t aesd_arena_buffer_count(const struct aesd_arena_buffer *buffer);
+
+extern uint64_t
+aesd_arena_buffer_first_seq(const struct aesd_arena_buffer *buffer);
+
+extern const struct aesd_arena_entry *
+aesd_arena_buffer_find_entry_for_offset(const struct aesd_arena_buffer *buffer,
+                                        uint64_t offset,
+                                        size_t *entry_offset_byte_rtn);
+
+extern size_t aesd_arena_buffer_copy(const struct aesd_arena_buffer *buffer,
+                                     uint64_t offset, char *dest,
+                                     size_t count);
+
+#endif /* AESD_ARENA_BUFFER_H */
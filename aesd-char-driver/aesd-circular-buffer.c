@@ -34,61 +34,492 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(
     struct aesd_circular_buffer *buffer, size_t char_offset,
     size_t *entry_offset_byte_rtn) {
 
-  size_t total = 0;
-  uint8_t index = buffer->out_offs;
-  for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i) {
-    index = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    total += buffer->entry[index].size;
-
-    // found
-    if (total > char_offset) {
-      break;
+  // offset past the end of the buffer
+  if (char_offset >= buffer->size) {
+    return NULL;
+  }
+
+  return aesd_circular_buffer_find_entry_for_offset(
+      buffer, aesd_circular_buffer_first_offset(buffer) + char_offset,
+      entry_offset_byte_rtn);
+}
+
+/**
+ * @return the position from the oldest of the entry of @param buffer holding
+ * @param offset, which must be stored in @param buffer
+ */
+static size_t aesd_circular_buffer_find_index_for_offset(
+    const struct aesd_circular_buffer *buffer, uint64_t offset) {
+  // last entry, from the oldest, starting at or before offset
+  size_t low = 0;
+  size_t high = aesd_circular_buffer_count(buffer) - 1;
+  while (low < high) {
+    size_t const mid = low + (high - low + 1) / 2;
+    if (buffer->entry_offs[aesd_entry_ring_index(buffer, mid)] <= offset) {
+      low = mid;
+    } else {
+      high = mid - 1;
     }
   }
+  return low;
+}
 
-  // offset past the end of the buffer
-  if (char_offset >= total) {
+/**
+ * Same as aesd_circular_buffer_find_entry_offset_for_fpos, but @param offset
+ * is a position in the stream of every byte ever added to @param buffer.
+ * Unlike a char_offset, it keeps designating the same byte when old entries
+ * are overwritten.
+ * @return the struct aesd_buffer_entry holding @param offset, or NULL if that
+ * byte was overwritten or not written yet.
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_offset(
+    struct aesd_circular_buffer *buffer, uint64_t offset,
+    size_t *entry_offset_byte_rtn) {
+
+  if (offset < aesd_circular_buffer_first_offset(buffer) ||
+      offset >= buffer->total_size) {
+    return NULL;
+  }
+
+  size_t const index = aesd_entry_ring_index(
+      buffer, aesd_circular_buffer_find_index_for_offset(buffer, offset));
+  *entry_offset_byte_rtn = offset - buffer->entry_offs[index];
+
+  return &buffer->entry[index];
+}
+
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed
+ * by caller.
+ * @param index the zero referenced entry to look for, 0 being the oldest entry
+ * in the buffer
+ * @param char_offset_rtn is a pointer specifying a location to store the
+ * zero referenced character index of the first byte of the entry if all
+ * buffer strings were concatenated end to end.  Only set when the entry
+ * exists.
+ * @return the struct aesd_buffer_entry at @param index or NULL if the buffer
+ * holds fewer entries.
+ */
+struct aesd_buffer_entry *
+aesd_circular_buffer_find_fpos_for_entry(struct aesd_circular_buffer *buffer,
+                                         size_t index, size_t *char_offset_rtn) {
+  if (index >= aesd_circular_buffer_count(buffer)) {
     return NULL;
   }
 
-  // return offset from begin
-  size_t const begin = total - buffer->entry[index].size;
-  *entry_offset_byte_rtn = char_offset - begin;
+  index = aesd_entry_ring_index(buffer, index);
+  *char_offset_rtn =
+      buffer->entry_offs[index] - aesd_circular_buffer_first_offset(buffer);
 
   return &buffer->entry[index];
 }
 
+/**
+ * Passes the bytes of @param buffer from @param offset, a position in the
+ * stream of every byte ever added, to @param copy, one contiguous run per
+ * entry, oldest first, until @param count bytes were passed, the newest entry
+ * was passed or @param copy returns less than it was given.
+ * @param ctx is passed to each call of @param copy.
+ * @return the number of bytes @param copy accepted, 0 if @param offset was
+ * overwritten or not written yet
+ */
+size_t aesd_circular_buffer_copy_range_to(
+    const struct aesd_circular_buffer *buffer, uint64_t offset, size_t count,
+    aesd_circular_buffer_copy_fn copy, void *ctx) {
+  size_t copied = 0;
+
+  if (offset < aesd_circular_buffer_first_offset(buffer) ||
+      offset >= buffer->total_size) {
+    return 0;
+  }
+
+  size_t const entries = aesd_circular_buffer_count(buffer);
+  for (size_t i = aesd_circular_buffer_find_index_for_offset(buffer, offset);
+       i < entries && copied < count; ++i) {
+    size_t const index = aesd_entry_ring_index(buffer, i);
+    size_t const entry_offset = offset + copied - buffer->entry_offs[index];
+    size_t size = buffer->entry[index].size - entry_offset;
+    if (size > count - copied) {
+      size = count - copied;
+    }
+
+    size_t const done =
+        copy(ctx, buffer->entry[index].buffptr + entry_offset, size);
+    copied += done;
+    if (done < size) {
+      break;
+    }
+  }
+
+  return copied;
+}
+
+static size_t aesd_circular_buffer_copy_to_memory(void *ctx, const char *src,
+                                                  size_t size) {
+  char **dest = (char **)ctx;
+
+  memcpy(*dest, src, size);
+  *dest += size;
+  return size;
+}
+
+/**
+ * Copies to @param dest up to @param count bytes of @param buffer starting at
+ * @param offset, a position in the stream of every byte ever added, across as
+ * many entries as they span.
+ * @return the number of bytes copied, 0 if @param offset was overwritten or
+ * not written yet
+ */
+size_t aesd_circular_buffer_copy_range(
+    const struct aesd_circular_buffer *buffer, uint64_t offset, char *dest,
+    size_t count) {
+  return aesd_circular_buffer_copy_range_to(
+      buffer, offset, count, aesd_circular_buffer_copy_to_memory, &dest);
+}
+
+/**
+ * @return the entry at position @param i from the first of @param entries
+ */
+static const struct aesd_buffer_entry *
+aesd_buffer_entries_at(const struct aesd_buffer_entries *entries, size_t i) {
+  size_t index = entries->first + i;
+
+  if (index >= entries->capacity) {
+    index -= entries->capacity;
+  }
+  return &entries->entry[index];
+}
+
+/**
+ * @return whether the @param len bytes of @param pattern are stored in
+ * @param entries from byte @param entry_offset of the entry at position
+ * @param index from the first on, continuing into the following entries
+ */
+static bool aesd_buffer_entries_match_at(
+    const struct aesd_buffer_entries *entries, size_t index,
+    size_t entry_offset, const char *pattern, size_t len) {
+  for (; len; ++index, entry_offset = 0) {
+    if (index >= entries->count) {
+      return false;
+    }
+
+    const struct aesd_buffer_entry *entry =
+        aesd_buffer_entries_at(entries, index);
+    size_t size = entry->size - entry_offset;
+    if (size > len) {
+      size = len;
+    }
+    if (memcmp(entry->buffptr + entry_offset, pattern, size) != 0) {
+      return false;
+    }
+    pattern += size;
+    len -= size;
+  }
+
+  return true;
+}
+
+/*
+** User space builds compare 16 candidate positions at once with the GCC vector
+** extensions, which compile to SSE2 or NEON. The kernel may not touch vector
+** registers outside kernel_fpu_begin(), so it only uses memchr.
+*/
+#if !defined(__KERNEL__) && defined(__GNUC__)
+#define AESD_SEARCH_VECTOR 1
+
+typedef unsigned char aesd_search_vector __attribute__((vector_size(16)));
+
+/**
+ * Looks for the @param len bytes of @param pattern within [*@param p,
+ * @param end), 16 positions at a time: a position is a candidate only when it
+ * holds the first byte of the pattern and holds its last byte len - 1 bytes
+ * later, which rules out nearly all of them with two compares, even when the
+ * first byte is common. Only positions where the whole pattern fits before
+ * @param end are scanned.
+ * @return the first match, or NULL with *@param p moved to the first position
+ * not scanned
+ */
+static const char *aesd_search_entry_vector(const char **p, const char *end,
+                                            const char *pattern, size_t len) {
+  aesd_search_vector const first =
+      (aesd_search_vector){0} + (unsigned char)pattern[0];
+  aesd_search_vector const last =
+      (aesd_search_vector){0} + (unsigned char)pattern[len - 1];
+  const char *s = *p;
+
+  for (; (size_t)(end - s) >= len - 1 + sizeof(aesd_search_vector);
+       s += sizeof(aesd_search_vector)) {
+    aesd_search_vector head, tail;
+    uint64_t any[2];
+
+    memcpy(&head, s, sizeof(head));
+    memcpy(&tail, s + len - 1, sizeof(tail));
+    aesd_search_vector const candidates =
+        (aesd_search_vector)((head == first) & (tail == last));
+    memcpy(any, &candidates, sizeof(any));
+    if (!(any[0] | any[1])) {
+      continue;
+    }
+
+    for (size_t k = 0; k < sizeof(aesd_search_vector); ++k) {
+      if (candidates[k] && memcmp(s + k + 1, pattern + 1, len - 1) == 0) {
+        return s + k;
+      }
+    }
+  }
+
+  *p = s;
+  return NULL;
+}
+#endif
+
+/**
+ * @return the first match of the @param len bytes of @param pattern starting
+ * in the entry at position @param i of @param entries, from its byte
+ * @param start on, or NULL
+ */
+static const char *
+aesd_buffer_entries_search_entry(const struct aesd_buffer_entries *entries,
+                                 size_t i, size_t start, const char *pattern,
+                                 size_t len) {
+  const struct aesd_buffer_entry *entry = aesd_buffer_entries_at(entries, i);
+  const char *const end = entry->buffptr + entry->size;
+  const char *p = entry->buffptr + start;
+
+#ifdef AESD_SEARCH_VECTOR
+  // matches within the entry, the positions left may run into the next ones
+  const char *match = aesd_search_entry_vector(&p, end, pattern, len);
+  if (match) {
+    return match;
+  }
+#endif
+
+  // candidates from memchr on the first byte, which skips over the rest of
+  // the entry word by word
+  for (; p < end && (p = (const char *)memchr(p, pattern[0], end - p)); ++p) {
+    if (aesd_buffer_entries_match_at(entries, i, p - entry->buffptr, pattern,
+                                     len)) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks for the @param pattern_len bytes of @param pattern in the bytes of
+ * @param entries as if they were concatenated, so a match may span several
+ * entries. Shared by aesd_circular_buffer_search and by callers holding
+ * records outside of a ring, so they all match the same way.
+ * @param index and @param entry_offset give the entry, from the first of
+ * @param entries, and the byte of that entry where the search starts, and are
+ * set to where the first match starts.
+ * @return whether a match was found, leaving @param index and
+ * @param entry_offset unchanged if not
+ */
+bool aesd_buffer_entries_search(const struct aesd_buffer_entries *entries,
+                                size_t *index, size_t *entry_offset,
+                                const char *pattern, size_t pattern_len) {
+  size_t start = *entry_offset;
+
+  if (pattern_len == 0) {
+    return *index < entries->count &&
+           start < aesd_buffer_entries_at(entries, *index)->size;
+  }
+
+  for (size_t i = *index; i < entries->count; ++i, start = 0) {
+    const char *match = aesd_buffer_entries_search_entry(entries, i, start,
+                                                         pattern, pattern_len);
+    if (match) {
+      *index = i;
+      *entry_offset = match - aesd_buffer_entries_at(entries, i)->buffptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Looks for the @param pattern_len bytes of @param pattern in the bytes of
+ * @param buffer as if all its entries were concatenated, so a match may span
+ * several entries, with aesd_buffer_entries_search.
+ * @param offset is the position in the stream of every byte ever added where
+ * the search starts, moved to the oldest byte if it was overwritten, and is
+ * set to the position of the first match.
+ * @return whether a match was found, leaving @param offset unchanged if not
+ */
+bool aesd_circular_buffer_search(const struct aesd_circular_buffer *buffer,
+                                 uint64_t *offset, const char *pattern,
+                                 size_t pattern_len) {
+  uint64_t start = *offset;
+
+  if (start < aesd_circular_buffer_first_offset(buffer)) {
+    start = aesd_circular_buffer_first_offset(buffer);
+  }
+  if (start >= buffer->total_size ||
+      pattern_len > buffer->total_size - start) {
+    return false;
+  }
+
+  struct aesd_buffer_entries const entries = {
+      .entry = buffer->entry,
+      .capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+      .first = buffer->out_offs,
+      .count = aesd_circular_buffer_count(buffer),
+  };
+  size_t i = aesd_circular_buffer_find_index_for_offset(buffer, start);
+  size_t entry_offset =
+      start - buffer->entry_offs[aesd_entry_ring_index(buffer, i)];
+  if (!aesd_buffer_entries_search(&entries, &i, &entry_offset, pattern,
+                                  pattern_len)) {
+    return false;
+  }
+
+  *offset = buffer->entry_offs[aesd_entry_ring_index(buffer, i)] + entry_offset;
+  return true;
+}
+
+/**
+ * @return the number of entries stored in @param buffer
+ */
+size_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer) {
+  return aesd_entry_ring_count(buffer);
+}
+
+/**
+ * @return the position of the oldest byte of @param buffer in the stream of
+ * every byte ever added, or the position the next entry will get when empty
+ */
+uint64_t
+aesd_circular_buffer_first_offset(const struct aesd_circular_buffer *buffer) {
+  return buffer->total_size - buffer->size;
+}
+
+/**
+ * @return the sequence number of the oldest entry of @param buffer, or the one
+ * the next entry will get when empty. Entries are numbered from 0 in the order
+ * they were added.
+ */
+uint64_t
+aesd_circular_buffer_first_seq(const struct aesd_circular_buffer *buffer) {
+  return buffer->total_entries - aesd_circular_buffer_count(buffer);
+}
+
+/**
+ * @return the sequence number of @param entry, which must be stored in
+ * @param buffer
+ */
+uint64_t
+aesd_circular_buffer_entry_seq(const struct aesd_circular_buffer *buffer,
+                               const struct aesd_buffer_entry *entry) {
+  size_t const index = entry - buffer->entry;
+  size_t const age =
+      AESD_RING_WRAP(index + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED -
+                         buffer->out_offs,
+                     AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+  return aesd_circular_buffer_first_seq(buffer) + age;
+}
+
 /**
  * Adds entry @param add_entry to @param buffer in the location specified in
  * buffer->in_offs. If the buffer was already full, overwrites the oldest entry
  * and advances buffer->out_offs to the new start location. Any necessary
  * locking must be handled by the caller Any memory referenced in @param
  * add_entry must be allocated by and/or must have a lifetime managed by the
- * caller.
+ * caller. Only the number of entries is limited, buffer->max_size is enforced
+ * by aesd_circular_buffer_add_entry_evict.
  * @return the struct aesd_buffer_entry overwritten or null.
  */
 struct aesd_buffer_entry aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
                                     const struct aesd_buffer_entry *add_entry) {
-  struct aesd_buffer_entry ret = buffer->entry[buffer->in_offs];
+  struct aesd_buffer_entry ret;
 
-  buffer->entry[buffer->in_offs] = *add_entry;
-  ++(buffer->in_offs);
-  buffer->in_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+  buffer->entry_offs[buffer->in_offs] = buffer->total_size;
+  buffer->total_size += add_entry->size;
+  ++(buffer->total_entries);
   buffer->size += add_entry->size;
 
-  if (buffer->full) {
-    ++(buffer->out_offs);
-    buffer->out_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+  if (aesd_entry_ring_push(buffer, add_entry, &ret)) {
     buffer->size -= ret.size;
-  } else {
-    if (buffer->in_offs == buffer->out_offs) {
-      buffer->full = true;
-    }
   }
 
   return ret;
 }
 
+/**
+ * Removes the oldest entry of @param buffer, which must not be empty, and
+ * clears its slot.
+ * @return the entry removed
+ */
+static struct aesd_buffer_entry
+aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer) {
+  struct aesd_buffer_entry *oldest = aesd_entry_ring_at(buffer, 0);
+  struct aesd_buffer_entry ret = aesd_entry_ring_pop(buffer);
+
+  memset(oldest, 0, sizeof(struct aesd_buffer_entry));
+  buffer->size -= ret.size;
+
+  return ret;
+}
+
+/**
+ * Adds entry @param add_entry to @param buffer like
+ * aesd_circular_buffer_add_entry, first evicting as many of the oldest entries
+ * as needed for the buffer to hold at most buffer->max_size bytes once
+ * @param add_entry is added. The new entry is always kept, even when larger
+ * than max_size on its own. Any necessary locking must be handled by the
+ * caller.
+ * @param evicted receives the entries removed, oldest first, so the caller can
+ * release their memory in one batch.
+ * @return the number of entries stored in @param evicted
+ */
+size_t aesd_circular_buffer_add_entry_evict(
+    struct aesd_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry,
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]) {
+  size_t count = 0;
+
+  if (buffer->full) {
+    evicted[count++] = aesd_circular_buffer_remove_oldest(buffer);
+  }
+
+  while (buffer->max_size && aesd_circular_buffer_count(buffer) &&
+         buffer->size + add_entry->size > buffer->max_size) {
+    evicted[count++] = aesd_circular_buffer_remove_oldest(buffer);
+  }
+
+  aesd_circular_buffer_add_entry(buffer, add_entry);
+  return count;
+}
+
+/**
+ * Sets the byte budget of @param buffer to @param max_size, 0 meaning no limit.
+ * Entries already stored are only evicted by the next
+ * aesd_circular_buffer_add_entry_evict.
+ */
+void aesd_circular_buffer_set_max_size(struct aesd_circular_buffer *buffer,
+                                       size_t max_size) {
+  buffer->max_size = max_size;
+}
+
+/**
+ * Makes the next entry added to the empty @param buffer get sequence number
+ * @param first_seq and start at position @param first_offset, so a buffer
+ * restored from a copy keeps numbering entries and bytes where it left off.
+ * @return false, leaving @param buffer unchanged, if anything was ever added
+ * to it
+ */
+bool aesd_circular_buffer_set_origin(struct aesd_circular_buffer *buffer,
+                                     uint64_t first_seq,
+                                     uint64_t first_offset) {
+  if (buffer->total_entries || buffer->total_size) {
+    return false;
+  }
+
+  buffer->total_entries = first_seq;
+  buffer->total_size = first_offset;
+  return true;
+}
+
 /**
  * Initializes the circular buffer described by @param buffer to an empty struct
  */
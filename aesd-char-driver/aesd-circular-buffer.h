@@ -16,7 +16,16 @@
 #include <stdint.h> // uintx_t
 #endif
 
+#include "aesd-ring.h"
+
+/*
+** Number of entries of the buffer. A power of two turns every index wrap into
+** a mask, builds override the default with -D. The driver keeps arrays of
+** that many entries on its stack, so kernel builds should stay within 64.
+*/
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
 
 struct aesd_buffer_entry {
   /**
@@ -31,38 +40,120 @@ struct aesd_buffer_entry {
 
 struct aesd_circular_buffer {
   /**
-   * An array of pointers to memory allocated for the most recent write
-   * operations
+   * entry, the memory allocated for the most recent write operations, in_offs,
+   * where the next write is stored, out_offs, the first location to read from,
+   * and full, set when every entry is used
    */
-  struct aesd_buffer_entry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
-  /**
-   * The current location in the entry structure where the next write should
-   * be stored.
-   */
-  uint8_t in_offs;
-  /**
-   * The first location in the entry structure to read from
-   */
-  uint8_t out_offs;
-  /**
-   * set to true when the buffer entry structure is full
-   */
-  bool full;
+  AESD_RING_FIELDS(struct aesd_buffer_entry,
+                   AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
   /*
   ** Sum of all size entries
   */
   size_t size;
+  /*
+  ** Position of the first byte of each entry in the stream of every byte ever
+  ** added, so finding the entry holding an offset is a binary search
+  */
+  uint64_t entry_offs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+  /*
+  ** Number of bytes ever added, the position one past the newest entry
+  */
+  uint64_t total_size;
+  /*
+  ** Number of entries ever added, the sequence number of the next entry
+  */
+  uint64_t total_entries;
+  /*
+  ** Most bytes aesd_circular_buffer_add_entry_evict keeps in the buffer, 0 for
+  ** no limit besides the number of entries
+  */
+  size_t max_size;
 };
 
+AESD_RING_DEFINE(aesd_entry_ring, struct aesd_circular_buffer,
+                 struct aesd_buffer_entry,
+                 AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+
 extern struct aesd_buffer_entry *
 aesd_circular_buffer_find_entry_offset_for_fpos(
     struct aesd_circular_buffer *buffer, size_t char_offset,
     size_t *entry_offset_byte_rtn);
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_offset(
+    struct aesd_circular_buffer *buffer, uint64_t offset,
+    size_t *entry_offset_byte_rtn);
+
+extern struct aesd_buffer_entry *
+aesd_circular_buffer_find_fpos_for_entry(struct aesd_circular_buffer *buffer,
+                                         size_t index, size_t *char_offset_rtn);
+
+/*
+** Consumer of the bytes passed by aesd_circular_buffer_copy_range_to
+** @return the number of the @param size bytes at @param src it accepted
+*/
+typedef size_t (*aesd_circular_buffer_copy_fn)(void *ctx, const char *src,
+                                               size_t size);
+
+extern size_t aesd_circular_buffer_copy_range_to(
+    const struct aesd_circular_buffer *buffer, uint64_t offset, size_t count,
+    aesd_circular_buffer_copy_fn copy, void *ctx);
+
+extern size_t
+aesd_circular_buffer_copy_range(const struct aesd_circular_buffer *buffer,
+                                uint64_t offset, char *dest, size_t count);
+
+/*
+** Entries searched by aesd_buffer_entries_search, in order: the count entries
+** of entry from entry[first] on, continuing at entry[0] past
+** entry[capacity - 1]
+*/
+struct aesd_buffer_entries {
+  const struct aesd_buffer_entry *entry;
+  size_t capacity;
+  size_t first;
+  size_t count;
+};
+
+extern bool
+aesd_buffer_entries_search(const struct aesd_buffer_entries *entries,
+                           size_t *index, size_t *entry_offset,
+                           const char *pattern, size_t pattern_len);
+
+extern bool
+aesd_circular_buffer_search(const struct aesd_circular_buffer *buffer,
+                            uint64_t *offset, const char *pattern,
+                            size_t pattern_len);
+
+extern size_t
+aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer);
+
+extern uint64_t
+aesd_circular_buffer_first_offset(const struct aesd_circular_buffer *buffer);
+
+extern uint64_t
+aesd_circular_buffer_first_seq(const struct aesd_circular_buffer *buffer);
+
+extern uint64_t
+aesd_circular_buffer_entry_seq(const struct aesd_circular_buffer *buffer,
+                               const struct aesd_buffer_entry *entry);
+
 extern struct aesd_buffer_entry
 aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
                                const struct aesd_buffer_entry *add_entry);
 
+extern size_t aesd_circular_buffer_add_entry_evict(
+    struct aesd_circular_buffer *buffer,
+    const struct aesd_buffer_entry *add_entry,
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]);
+
+extern void
+aesd_circular_buffer_set_max_size(struct aesd_circular_buffer *buffer,
+                                  size_t max_size);
+
+extern bool
+aesd_circular_buffer_set_origin(struct aesd_circular_buffer *buffer,
+                                uint64_t first_seq, uint64_t first_offset);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
 /**
@@ -71,8 +162,9 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  * free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an
- * index Example usage: uint8_t index; struct aesd_circular_buffer buffer;
+ * @param index is an aesd_ring_index_t stack allocated value used by this macro
+ * for an index Example usage: aesd_ring_index_t index;
+ * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
  *      free(entry->buffptr);
@@ -83,4 +175,19 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
        index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;                        \
        index++, entryptr = &((buffer)->entry[index]))
 
+/**
+ * Create a for loop to iterate over the entries stored in the circular buffer,
+ * from the oldest to the newest, unlike AESD_CIRCULAR_BUFFER_FOREACH which
+ * visits every slot in storage order. Any necessary locking must be performed
+ * by the caller.
+ * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
+ * @param buffer is the struct aesd_circular_buffer * describing the buffer
+ * @param index is a size_t stack allocated value set to the position of the
+ * current entry from the oldest
+ */
+#define AESD_CIRCULAR_BUFFER_FOREACH_IN_ORDER(entryptr, buffer, index)         \
+  for (index = 0, entryptr = aesd_entry_ring_at((buffer), 0);                  \
+       index < aesd_entry_ring_count(buffer);                                  \
+       index++, entryptr = aesd_entry_ring_at((buffer), index))
+
 #endif /* AESD_CIRCULAR_BUFFER_H */
@@ -0,0 +1,110 @@
+/*
+ * aesd-ring.h
+ *
+ * Fixed capacity rings of any element type, generated by macros so the
+ * capacity is a compile time constant: with a power of two capacity every
+ * index wraps with a mask, otherwise with a compare and subtract, never with
+ * a division. Shared by the kernel driver and user space.
+ *
+ * A ring is a struct holding AESD_RING_FIELDS, next to any other member, and
+ * AESD_RING_DEFINE generates its static inline accessors.
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#endif
+
+/**
+ * Type of the ring indices, wide enough for any capacity an array can hold
+ */
+typedef uint32_t aesd_ring_index_t;
+
+/**
+ * Members of a ring of @param capacity elements of @param type, placed in a
+ * struct definition:
+ * - entry, the elements
+ * - in_offs, the location in entry where the next element is stored
+ * - out_offs, the location of the oldest element
+ * - full, set when every location holds an element, in_offs then equals
+ *   out_offs
+ */
+#define AESD_RING_FIELDS(type, capacity)                                       \
+  type entry[capacity];                                                        \
+  aesd_ring_index_t in_offs;                                                   \
+  aesd_ring_index_t out_offs;                                                  \
+  bool full
+
+#define AESD_RING_IS_POWER_OF_2(n) ((n) != 0 && ((n) & ((n)-1)) == 0)
+
+/**
+ * @return @param index, which must be below twice @param capacity, wrapped
+ * into [0, capacity). Both branches are resolved at compile time.
+ */
+#define AESD_RING_WRAP(index, capacity)                                        \
+  (AESD_RING_IS_POWER_OF_2(capacity)                                           \
+       ? (index) & ((capacity)-1)                                              \
+       : ((index) >= (capacity) ? (index) - (capacity) : (index)))
+
+/**
+ * Define the accessors of @param ring_type, a struct holding
+ * AESD_RING_FIELDS(@param elem_type, @param capacity), named after
+ * @param prefix:
+ * - prefix_count(ring): number of elements stored
+ * - prefix_index(ring, i): location in entry of the i-th oldest element
+ * - prefix_at(ring, i): the i-th oldest element, i < prefix_count(ring)
+ * - prefix_push(ring, elem): store a copy of elem as the newest element,
+ *   dropping the oldest one when full
+ * - prefix_pop(ring): remove the oldest element, the ring must not be empty
+ * Any necessary locking must be performed by the caller.
+ */
+#define AESD_RING_DEFINE(prefix, ring_type, elem_type, capacity)               \
+  static inline size_t prefix##_count(const ring_type *ring) {                 \
+    if (ring->full) {                                                          \
+      return (capacity);                                                       \
+    }                                                                          \
+    return AESD_RING_WRAP(ring->in_offs + (capacity)-ring->out_offs,           \
+                          (capacity));                                         \
+  }                                                                            \
+                                                                               \
+  static inline aesd_ring_index_t prefix##_index(const ring_type *ring,        \
+                                                 size_t i) {                   \
+    return AESD_RING_WRAP(ring->out_offs + (aesd_ring_index_t)i, (capacity));  \
+  }                                                                            \
+                                                                               \
+  static inline elem_type *prefix##_at(ring_type *ring, size_t i) {            \
+    return &ring->entry[prefix##_index(ring, i)];                              \
+  }                                                                            \
+                                                                               \
+  /* @return whether the oldest element was dropped, then stored in          \
+   * @param dropped */                                                         \
+  static inline bool prefix##_push(ring_type *ring, const elem_type *elem,     \
+                                   elem_type *dropped) {                       \
+    bool was_full = ring->full;                                                \
+                                                                               \
+    *dropped = ring->entry[ring->in_offs];                                     \
+    ring->entry[ring->in_offs] = *elem;                                        \
+    ring->in_offs = AESD_RING_WRAP(ring->in_offs + 1, (capacity));             \
+    if (was_full) {                                                            \
+      ring->out_offs = ring->in_offs;                                          \
+    } else {                                                                   \
+      ring->full = ring->in_offs == ring->out_offs;                            \
+    }                                                                          \
+    return was_full;                                                           \
+  }                                                                            \
+                                                                               \
+  static inline elem_type prefix##_pop(ring_type *ring) {                      \
+    elem_type elem = ring->entry[ring->out_offs];                              \
+                                                                               \
+    ring->out_offs = AESD_RING_WRAP(ring->out_offs + 1, (capacity));           \
+    ring->full = false;                                                        \
+    return elem;                                                               \
+  }
+
+#endif /* AESD_RING_H */
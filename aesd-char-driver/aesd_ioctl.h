@@ -33,15 +33,236 @@ struct aesd_seekto {
   uint32_t write_cmd_offset;
 };
 
+/**
+ * One record appended by AESDCHAR_IOCAPPEND
+ */
+struct aesd_record {
+  /**
+   * User space address of the record bytes
+   */
+  uint64_t buf;
+  /**
+   * Number of bytes in the record, which is stored as is: no '\n' is needed
+   * nor looked for. At most the max_buffer_size module parameter when it is
+   * not 0
+   */
+  uint64_t size;
+};
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space, describing
+ * records appended to the ring in a single operation
+ */
+struct aesd_append {
+  /**
+   * User space address of an array of count struct aesd_record
+   */
+  uint64_t records;
+  /**
+   * Number of records, between 1 and AESDCHAR_APPEND_MAX_RECORDS
+   */
+  uint32_t count;
+  /**
+   * Must be zero
+   */
+  uint32_t flags;
+  /**
+   * Set by the driver: the records got sequence numbers first_seq to
+   * first_seq + count - 1, in array order
+   */
+  uint64_t first_seq;
+};
+
+#define AESDCHAR_APPEND_MAX_RECORDS 1024
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space, filled
+ * with the layout of the ring
+ */
+struct aesd_info {
+  /**
+   * Maximum number of records held by the ring
+   */
+  uint32_t capacity;
+  /**
+   * Number of records in the ring
+   */
+  uint32_t count;
+  /**
+   * Number of bytes in the ring, pending partial writes excluded
+   */
+  uint64_t total_bytes;
+  /**
+   * Sequence number of the oldest record, or of the next one when empty
+   */
+  uint64_t first_seq;
+  /**
+   * Sequence number of the newest record, first_seq - 1 when empty
+   */
+  uint64_t last_seq;
+  /**
+   * File position of the first byte of the oldest record. The newest record
+   * ends at first_offset + total_bytes
+   */
+  uint64_t first_offset;
+  /**
+   * Set by the caller: user space address of an array of sizes_len uint64_t,
+   * or 0. The driver stores there the size of the sizes_len oldest records
+   * and lowers sizes_len to the number it stored
+   */
+  uint64_t sizes;
+  uint32_t sizes_len;
+  /**
+   * Must be zero
+   */
+  uint32_t flags;
+};
+
+#define AESDCHAR_SNAPSHOT_MAGIC 0x41455344 /* "AESD" */
+#define AESDCHAR_SNAPSHOT_VERSION 1
+
+/**
+ * Start of a ring snapshot, followed by count uint64_t record sizes and then
+ * by the bytes of every record, oldest first
+ */
+struct aesd_snapshot_header {
+  /**
+   * AESDCHAR_SNAPSHOT_MAGIC and AESDCHAR_SNAPSHOT_VERSION
+   */
+  uint32_t magic;
+  uint32_t version;
+  /**
+   * Number of records, at most AESDCHAR_APPEND_MAX_RECORDS
+   */
+  uint32_t count;
+  /**
+   * Must be zero
+   */
+  uint32_t flags;
+  /**
+   * Sequence number of the first record
+   */
+  uint64_t first_seq;
+  /**
+   * File position of the first byte of the first record
+   */
+  uint64_t first_offset;
+};
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space,
+ * describing a user space buffer holding a ring snapshot
+ */
+struct aesd_snapshot {
+  /**
+   * User space address of the snapshot
+   */
+  uint64_t buf;
+  /**
+   * Size of buf in bytes. AESDCHAR_IOCEXPORT sets it to the size of the
+   * snapshot, also when failing with ERANGE because buf is too small
+   */
+  uint64_t size;
+};
+
 // Pick an arbitrary unused value from
 // https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+
+/*
+** Set follow mode on the open file: with a nonzero argument, reads at the end
+** of the ring wait for the next record instead of returning 0, or fail with
+** EAGAIN when the file is O_NONBLOCK. Pair with poll/epoll to tail the device.
+*/
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+
+/*
+** Append several records under a single lock acquisition. A pending partial
+** write stays pending and is committed after them. Fails with EBADF when the
+** file is not open for writing.
+*/
+#define AESDCHAR_IOCAPPEND _IOWR(AESD_IOC_MAGIC, 3, struct aesd_append)
+
+// Read the ring layout and its record sizes in a single call
+#define AESDCHAR_IOCGINFO _IOWR(AESD_IOC_MAGIC, 4, struct aesd_info)
+
+/*
+** Copy every record of the ring with its sequence number and file position
+** to a snapshot, in a single lock acquisition. Pending partial writes are not
+** part of it. Fails with EBADF when the file is not open for reading.
+*/
+#define AESDCHAR_IOCEXPORT _IOWR(AESD_IOC_MAGIC, 5, struct aesd_snapshot)
+
+/*
+** Fill an empty ring from a snapshot made by AESDCHAR_IOCEXPORT, keeping the
+** sequence numbers and file positions of its records. Fails with EBUSY once
+** anything was written to the device, with EINVAL when the positions of the
+** records would not fit a file offset, and with EBADF when the file is not
+** open for writing.
+*/
+#define AESDCHAR_IOCIMPORT _IOW(AESD_IOC_MAGIC, 6, struct aesd_snapshot)
+
+/**
+ * Maximum number of records described by struct aesd_mmap_header
+ */
+#define AESDCHAR_MMAP_MAX_ENTRIES 128
+
+/**
+ * A record exposed through the read only mapping of the device
+ */
+struct aesd_mmap_entry {
+  /**
+   * Sequence number of the record, incremented by one for each record
+   */
+  uint64_t seq;
+  /**
+   * Offset of the first byte of the record within the data area
+   */
+  uint32_t offset;
+  /**
+   * Number of bytes in the record. A record running past the end of the data
+   * area continues at its offset 0
+   */
+  uint32_t size;
+};
+
+/**
+ * First page of the read only mapping of the device, followed at data_offset
+ * by data_size bytes of record storage. The driver increments update_count
+ * before and after every change, so a reader copying a record must retry
+ * whenever update_count was odd or changed while it was copying.
+ */
+struct aesd_mmap_header {
+  uint32_t update_count;
+  /**
+   * Offset of the data area from the start of the mapping
+   */
+  uint32_t data_offset;
+  /**
+   * Size of the data area in bytes
+   */
+  uint32_t data_size;
+  /**
+   * Number of valid records in entry, oldest first
+   */
+  uint32_t count;
+  /**
+   * Sequence number of entry[0], equal to head_seq when count is zero
+   */
+  uint64_t tail_seq;
+  /**
+   * Sequence number the next committed record will get
+   */
+  uint64_t head_seq;
+  struct aesd_mmap_entry entry[AESDCHAR_MMAP_MAX_ENTRIES];
+};
+
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 6
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,138 @@
+/*
+ * aesdchar-trace.h
+ *
+ * Tracepoints at entry and exit of the aesdchar file operations, found under
+ * /sys/kernel/tracing/events/aesdchar. Pairing an _enter event with the
+ * following _exit event of the same task gives the latency of the call, e.g.
+ * with a synthetic event or perf script, without rebuilding the module.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(_AESDCHAR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AESDCHAR_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+/*
+** A read or write of @param size bytes starting at file position @param pos
+*/
+DECLARE_EVENT_CLASS(aesd_io_enter,
+
+                    TP_PROTO(size_t size, loff_t pos),
+
+                    TP_ARGS(size, pos),
+
+                    TP_STRUCT__entry(__field(size_t, size)
+                                         __field(loff_t, pos)),
+
+                    TP_fast_assign(__entry->size = size; __entry->pos = pos;),
+
+                    TP_printk("size=%zu pos=%lld", __entry->size,
+                              __entry->pos));
+
+DEFINE_EVENT(aesd_io_enter, aesd_read_enter, TP_PROTO(size_t size, loff_t pos),
+             TP_ARGS(size, pos));
+
+DEFINE_EVENT(aesd_io_enter, aesd_write_enter,
+             TP_PROTO(size_t size, loff_t pos), TP_ARGS(size, pos));
+
+/*
+** End of a read or write returning @param ret, leaving the file at
+** @param pos. @param seq is the sequence number of the first record read or
+** committed, or of the next record when there was none. @param lock_wait_ns
+** is the time spent waiting for buffer_mutex.
+*/
+DECLARE_EVENT_CLASS(aesd_io_exit,
+
+                    TP_PROTO(ssize_t ret, loff_t pos, u64 seq,
+                             u64 lock_wait_ns),
+
+                    TP_ARGS(ret, pos, seq, lock_wait_ns),
+
+                    TP_STRUCT__entry(__field(ssize_t, ret) __field(loff_t, pos)
+                                         __field(u64, seq)
+                                             __field(u64, lock_wait_ns)),
+
+                    TP_fast_assign(__entry->ret = ret; __entry->pos = pos;
+                                   __entry->seq = seq;
+                                   __entry->lock_wait_ns = lock_wait_ns;),
+
+                    TP_printk("ret=%zd pos=%lld seq=%llu lock_wait_ns=%llu",
+                              __entry->ret, __entry->pos, __entry->seq,
+                              __entry->lock_wait_ns));
+
+DEFINE_EVENT(aesd_io_exit, aesd_read_exit,
+             TP_PROTO(ssize_t ret, loff_t pos, u64 seq, u64 lock_wait_ns),
+             TP_ARGS(ret, pos, seq, lock_wait_ns));
+
+DEFINE_EVENT(aesd_io_exit, aesd_write_exit,
+             TP_PROTO(ssize_t ret, loff_t pos, u64 seq, u64 lock_wait_ns),
+             TP_ARGS(ret, pos, seq, lock_wait_ns));
+
+TRACE_EVENT(aesd_llseek_enter,
+
+            TP_PROTO(loff_t off, int whence),
+
+            TP_ARGS(off, whence),
+
+            TP_STRUCT__entry(__field(loff_t, off) __field(int, whence)),
+
+            TP_fast_assign(__entry->off = off; __entry->whence = whence;),
+
+            TP_printk("off=%lld whence=%d", __entry->off, __entry->whence));
+
+TRACE_EVENT(aesd_llseek_exit,
+
+            TP_PROTO(loff_t ret, u64 lock_wait_ns),
+
+            TP_ARGS(ret, lock_wait_ns),
+
+            TP_STRUCT__entry(__field(loff_t, ret) __field(u64, lock_wait_ns)),
+
+            TP_fast_assign(__entry->ret = ret;
+                           __entry->lock_wait_ns = lock_wait_ns;),
+
+            TP_printk("ret=%lld lock_wait_ns=%llu", __entry->ret,
+                      __entry->lock_wait_ns));
+
+TRACE_EVENT(aesd_ioctl_enter,
+
+            TP_PROTO(unsigned int cmd, unsigned long arg),
+
+            TP_ARGS(cmd, arg),
+
+            TP_STRUCT__entry(__field(unsigned int, cmd)
+                                 __field(unsigned long, arg)),
+
+            TP_fast_assign(__entry->cmd = cmd; __entry->arg = arg;),
+
+            TP_printk("cmd=%#x nr=%u arg=%#lx", __entry->cmd,
+                      _IOC_NR(__entry->cmd), __entry->arg));
+
+TRACE_EVENT(aesd_ioctl_exit,
+
+            TP_PROTO(unsigned int cmd, long ret, u64 lock_wait_ns),
+
+            TP_ARGS(cmd, ret, lock_wait_ns),
+
+            TP_STRUCT__entry(__field(unsigned int, cmd) __field(long, ret)
+                                 __field(u64, lock_wait_ns)),
+
+            TP_fast_assign(__entry->cmd = cmd; __entry->ret = ret;
+                           __entry->lock_wait_ns = lock_wait_ns;),
+
+            TP_printk("cmd=%#x nr=%u ret=%ld lock_wait_ns=%llu", __entry->cmd,
+                      _IOC_NR(__entry->cmd), __entry->ret,
+                      __entry->lock_wait_ns));
+
+#endif /* _AESDCHAR_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar-trace
+#include <trace/define_trace.h>
@@ -8,7 +8,7 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1 // Remove comment on this line to enable debug
+//#define AESD_DEBUG 1 // Remove comment on this line to enable debug
 
 #undef PDEBUG /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -24,20 +24,65 @@
 #endif
 
 #include <linux/cdev.h>
+#include <linux/completion.h>
+#include <linux/llist.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/refcount.h>
+#include <linux/wait.h>
 
 #include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
 
 int aesd_open(struct inode *inode, struct file *filp);
 void aesd_cleanup_module(void);
 int aesd_init_module(void);
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos);
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                  loff_t *f_pos);
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from);
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to);
 int aesd_release(struct inode *inode, struct file *filp);
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence);
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma);
+__poll_t aesd_poll(struct file *filp, poll_table *wait);
+
+/*
+** Counters exported in debugfs/aesdchar/stats. All of them are updated with
+** buffer_mutex held, except alloc_failures which also counts failures of
+** allocations made before taking it.
+*/
+struct aesd_stats {
+  uint64_t writes;          /* write calls */
+  uint64_t write_bytes;     /* bytes accepted by write calls */
+  uint64_t reads;           /* read calls */
+  uint64_t read_bytes;      /* bytes returned by read calls */
+  uint64_t records;         /* records committed to the ring */
+  uint64_t partial_commits; /* records assembled from several writes */
+  uint64_t evictions;       /* records overwritten by newer ones */
+  uint64_t lock_acquired;   /* buffer_mutex acquisitions */
+  uint64_t lock_contended;  /* acquisitions that had to wait */
+  uint64_t lock_wait_ns;    /* time spent waiting for buffer_mutex */
+  uint64_t lock_hold_ns;    /* time buffer_mutex was held */
+  uint64_t lock_hold_max_ns;
+  atomic64_t alloc_failures;
+};
+
+/*
+** A complete record copied in by a writer, waiting to be committed by
+** whoever takes or releases buffer_mutex next. Freed by the last of the
+** writer and that task to drop its reference.
+*/
+struct aesd_staged_record {
+  struct llist_node node;
+  char *buffptr;
+  size_t size;
+  refcount_t refs;
+
+  /* set by the task that commits it, under buffer_mutex, before done */
+  struct completion done;
+  ssize_t result;
+  uint64_t seq;
+};
 
 struct aesd_dev {
   struct cdev cdev; /* Char device structure      */
@@ -45,7 +90,55 @@ struct aesd_dev {
   struct aesd_circular_buffer buffer;
   struct mutex buffer_mutex;
 
-  struct aesd_buffer_entry partial_entry;
+  /* complete records waiting for buffer_mutex, one list per CPU */
+  struct llist_head __percpu *staged_records;
+  /*
+  ** Number of records on those lists, checked on every unlock instead of
+  ** scanning them. Counted once on its list, so it may briefly go negative
+  ** when a record is published before its writer counted it.
+  */
+  atomic_t staged_count;
+
+  /* readers waiting for the next record, woken on every commit */
+  wait_queue_head_t read_queue;
+
+  /*
+  ** Bytes of a record still waiting for its terminating '\n'. The buffer
+  ** grows geometrically so a record built from many small writes is copied
+  ** in amortized O(1) per byte, and is kept around for the next record.
+  */
+  char *partial_buf;
+  size_t partial_size;
+  size_t partial_capacity;
+
+  /*
+  ** Read only view handed out by aesd_mmap: a struct aesd_mmap_header page
+  ** followed by a byte ring holding copies of the committed records.
+  ** Allocated at module load, unless mmap_data_size is 0.
+  */
+  struct aesd_mmap_header *mmap_header;
+  uint64_t mmap_head; /* bytes ever stored in the data area */
+  uint64_t mmap_tail; /* position of the first byte of entry[0] */
+
+  struct aesd_stats stats;
+  uint64_t lock_start_ns; /* when buffer_mutex was last acquired */
+  struct dentry *debugfs;
+};
+
+/*
+** State of one open file of the device, kept in filp->private_data
+*/
+struct aesd_file {
+  struct aesd_dev *dev;
+
+  /* reads at the end of the ring wait for the next record, see
+   * AESDCHAR_IOCFOLLOW */
+  bool follow;
+
+  /* where the next read starts after one failed with -EPIPE, since the VFS
+   * keeps f_pos on errors, 0 when none. Used under buffer_mutex, cleared by
+   * llseek. */
+  loff_t resume_pos;
 };
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
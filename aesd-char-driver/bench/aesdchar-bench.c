@@ -0,0 +1,126 @@
+/**
+ * @file aesdchar-bench.c
+ * @brief Write throughput benchmark for the aesdchar device
+ *
+ * Builds records out of many small writes, the pattern that exercises the
+ * partial record path of aesd_write, and reports the cost per write and per
+ * record for each write size.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_DEVICE "/dev/aesdchar"
+#define DEFAULT_RECORDS 100
+#define DEFAULT_RECORD_SIZE 4096
+
+static const size_t write_sizes[] = {1, 64};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+** write @param records records of @param record_size bytes to @param fd, each
+** split in writes of at most @param write_size bytes
+** @return the number of write calls performed or -1 on error
+*/
+static long write_records(int fd, const char *record, size_t record_size,
+                          size_t write_size, int records) {
+  long writes = 0;
+  for (int i = 0; i < records; ++i) {
+    size_t done = 0;
+    while (done < record_size) {
+      size_t chunk = record_size - done;
+      if (chunk > write_size) {
+        chunk = write_size;
+      }
+
+      ssize_t ret = write(fd, record + done, chunk);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("write");
+        return -1;
+      }
+      done += ret;
+      ++writes;
+    }
+  }
+  return writes;
+}
+
+int main(int argc, char **argv) {
+  const char *device = DEFAULT_DEVICE;
+  int records = DEFAULT_RECORDS;
+  size_t record_size = DEFAULT_RECORD_SIZE;
+
+  int c;
+  while ((c = getopt(argc, argv, "d:n:s:")) != -1) {
+    switch (c) {
+    case 'd':
+      device = optarg;
+      break;
+    case 'n':
+      records = atoi(optarg);
+      break;
+    case 's':
+      record_size = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-d device] [-n records] [-s record_size]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (records <= 0 || record_size == 0) {
+    fprintf(stderr, "records and record_size must be positive\n");
+    return 1;
+  }
+
+  char *record = malloc(record_size);
+  if (record == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  memset(record, 'a', record_size - 1);
+  record[record_size - 1] = '\n';
+
+  int fd = open(device, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "open %s: %s\n", device, strerror(errno));
+    free(record);
+    return 1;
+  }
+
+  int rc = 0;
+  for (size_t i = 0; i < sizeof(write_sizes) / sizeof(write_sizes[0]); ++i) {
+    double start = now_ns();
+    long writes =
+        write_records(fd, record, record_size, write_sizes[i], records);
+    double elapsed = now_ns() - start;
+    if (writes < 0) {
+      rc = 1;
+      break;
+    }
+
+    printf("write_size=%zu record_size=%zu records=%d: %.1f ns/write "
+           "%.1f us/record %.2f MB/s\n",
+           write_sizes[i], record_size, records, elapsed / writes,
+           elapsed / records / 1e3,
+           (double)record_size * records / elapsed * 1e3);
+  }
+
+  close(fd);
+  free(record);
+  return rc;
+}
@@ -13,12 +13,25 @@
 
 #include "aesd_ioctl.h"
 #include "aesdchar.h"
+#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h> // file_operations
 #include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/math64.h> // div_u64_rem
+#include <linux/mm.h> // kvmalloc
 #include <linux/module.h>
 #include <linux/printk.h>
+#include <linux/refcount.h>
+#include <linux/seq_file.h> // DEFINE_SHOW_ATTRIBUTE
 #include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/uio.h> // iov_iter
+#include <linux/version.h>
+#include <linux/vmalloc.h> // vmalloc_user
+
+#define CREATE_TRACE_POINTS
+#include "aesdchar-trace.h"
 
 int aesd_major = 0; // use dynamic major
 int aesd_minor = 0;
@@ -28,201 +41,1305 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 struct aesd_dev aesd_device;
 
+/*
+** Account for an acquisition of buffer_mutex that had to wait since
+** @param wait_start when @param contended
+*/
+static void aesd_lock_acquired(struct aesd_dev *dev, bool contended,
+                               uint64_t wait_start, uint64_t *wait_ns) {
+  dev->lock_start_ns = ktime_get_ns();
+  ++dev->stats.lock_acquired;
+  if (contended) {
+    uint64_t waited = dev->lock_start_ns - wait_start;
+
+    ++dev->stats.lock_contended;
+    dev->stats.lock_wait_ns += waited;
+    if (wait_ns) {
+      *wait_ns += waited;
+    }
+  }
+}
+
+/*
+** Take buffer_mutex, accounting for the time spent waiting when another task
+** holds it, which is also added to @param wait_ns unless NULL. The
+** uncontended path only costs a trylock and a clock read.
+** @return 0, or -EINTR when interrupted by a signal while waiting
+*/
+static int aesd_lock(struct aesd_dev *dev, uint64_t *wait_ns) {
+  if (mutex_trylock(&dev->buffer_mutex)) {
+    aesd_lock_acquired(dev, false, 0, wait_ns);
+    return 0;
+  }
+
+  uint64_t wait_start = ktime_get_ns();
+  if (mutex_lock_interruptible(&dev->buffer_mutex)) {
+    return -EINTR;
+  }
+  aesd_lock_acquired(dev, true, wait_start, wait_ns);
+  return 0;
+}
+
+static struct llist_node *aesd_publish_staged(struct aesd_dev *dev);
+static void aesd_complete_staged(struct llist_node *published);
+
+/*
+** @return true if a record is staged on any CPU. The barrier orders the
+** release of buffer_mutex before the check, as aesd_stage_record orders
+** counting its record before its mutex_trylock: either that writer gets the
+** lock, or the task that released it sees the count.
+*/
+static bool aesd_staged_pending(struct aesd_dev *dev) {
+  smp_mb();
+  return atomic_read(&dev->staged_count) > 0;
+}
+
+static void aesd_unlock_timed(struct aesd_dev *dev) {
+  uint64_t held = ktime_get_ns() - dev->lock_start_ns;
+
+  dev->stats.lock_hold_ns += held;
+  if (held > dev->stats.lock_hold_max_ns) {
+    dev->stats.lock_hold_max_ns = held;
+  }
+  mutex_unlock(&dev->buffer_mutex);
+}
+
+/*
+** Publish the records staged while buffer_mutex was held by the caller, who
+** just released it. Their writers found the lock taken and sleep until their
+** record is in the ring, so whoever releases the lock publishes them, unless
+** another task took it meanwhile and will do so in turn.
+*/
+static void aesd_publish_pending(struct aesd_dev *dev) {
+  while (aesd_staged_pending(dev) && mutex_trylock(&dev->buffer_mutex)) {
+    aesd_lock_acquired(dev, false, 0, NULL);
+    struct llist_node *published = aesd_publish_staged(dev);
+    aesd_unlock_timed(dev);
+    aesd_complete_staged(published);
+  }
+}
+
+static void aesd_unlock(struct aesd_dev *dev) {
+  aesd_unlock_timed(dev);
+  aesd_publish_pending(dev);
+}
+
+/*
+** Records up to this size come from a dedicated slab cache. Larger ones are
+** page backed through kvmalloc, falling back to vmalloc instead of failing
+** when no physically contiguous block is available.
+*/
+#define AESD_RECORD_CACHE_SIZE 256
+
+static struct kmem_cache *aesd_record_cache;
+
+static char *aesd_record_alloc(struct aesd_dev *dev, size_t size) {
+  char *buffptr;
+
+  if (size <= AESD_RECORD_CACHE_SIZE) {
+    buffptr = (char *)kmem_cache_alloc(aesd_record_cache, GFP_KERNEL);
+  } else {
+    buffptr = (char *)kvmalloc(size, GFP_KERNEL);
+  }
+
+  if (!buffptr) {
+    atomic64_inc(&dev->stats.alloc_failures);
+  }
+  return buffptr;
+}
+
+static void aesd_record_free(const char *buffptr, size_t size) {
+  if (!buffptr) {
+    return;
+  }
+
+  if (size <= AESD_RECORD_CACHE_SIZE) {
+    kmem_cache_free(aesd_record_cache, (void *)buffptr);
+  } else {
+    kvfree(buffptr);
+  }
+}
+
+/*
+** Free the @param count records of @param entries, returning the cache backed
+** ones to their slab in one call
+*/
+static void aesd_record_free_batch(const struct aesd_buffer_entry *entries,
+                                   size_t count) {
+  void *cached[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+  size_t ncached = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    if (entries[i].buffptr && entries[i].size <= AESD_RECORD_CACHE_SIZE) {
+      cached[ncached++] = (void *)entries[i].buffptr;
+    } else {
+      aesd_record_free(entries[i].buffptr, entries[i].size);
+    }
+  }
+
+  if (ncached) {
+    kmem_cache_free_bulk(aesd_record_cache, ncached, cached);
+  }
+}
+
+/*
+** Most bytes of records kept in the ring, besides the limit on their number.
+** Large records are vmalloc backed, so without a budget every writer could
+** pin AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED records of MAX_RW_COUNT bytes.
+*/
+static unsigned long max_buffer_size = 16 * 1024 * 1024;
+module_param(max_buffer_size, ulong, 0444);
+MODULE_PARM_DESC(max_buffer_size,
+                 "bytes of records kept before evicting the oldest, 0 for "
+                 "no limit");
+
+/*
+** A record larger than the byte budget would evict every other one and still
+** exceed it, so it is refused instead
+*/
+static bool aesd_record_too_large(struct aesd_dev *dev, size_t size) {
+  return dev->buffer.max_size && size > dev->buffer.max_size;
+}
+
+/*
+** Size of the data area of the read only mapping
+*/
+static unsigned int mmap_data_size = 256 * 1024;
+module_param(mmap_data_size, uint, 0444);
+MODULE_PARM_DESC(mmap_data_size, "bytes of record storage exposed by mmap");
+
+static void aesd_mmap_drop_oldest(struct aesd_dev *dev) {
+  struct aesd_mmap_header *header = dev->mmap_header;
+
+  dev->mmap_tail += header->entry[0].size;
+  --header->count;
+  memmove(&header->entry[0], &header->entry[1],
+          header->count * sizeof(struct aesd_mmap_entry));
+}
+
+/*
+** Copy @param entry, committed with sequence number @param seq, to the mapped
+** view and drop the records it overwrote or that the ring no longer holds.
+** Caller holds buffer_mutex.
+*/
+static void aesd_mmap_commit(struct aesd_dev *dev,
+                             const struct aesd_buffer_entry *entry,
+                             uint64_t seq) {
+  struct aesd_mmap_header *header = dev->mmap_header;
+  if (!header) {
+    return;
+  }
+
+  WRITE_ONCE(header->update_count, header->update_count + 1);
+  smp_wmb();
+
+  if (entry->size > header->data_size) {
+    // does not fit, and storing it would overwrite every other record
+    header->count = 0;
+    dev->mmap_tail = dev->mmap_head;
+  } else {
+    char *data = (char *)header + header->data_offset;
+    uint32_t offset;
+    div_u64_rem(dev->mmap_head, header->data_size, &offset);
+    size_t first = min_t(size_t, entry->size, header->data_size - offset);
+
+    memcpy(data + offset, entry->buffptr, first);
+    memcpy(data, entry->buffptr + first, entry->size - first);
+
+    if (header->count == AESDCHAR_MMAP_MAX_ENTRIES) {
+      aesd_mmap_drop_oldest(dev);
+    }
+    header->entry[header->count++] = (struct aesd_mmap_entry){
+        .seq = seq, .offset = offset, .size = entry->size};
+    dev->mmap_head += entry->size;
+
+    while (header->count > aesd_circular_buffer_count(&dev->buffer) ||
+           dev->mmap_head - dev->mmap_tail > header->data_size) {
+      aesd_mmap_drop_oldest(dev);
+    }
+  }
+
+  header->head_seq = seq + 1;
+  header->tail_seq = header->count ? header->entry[0].seq : header->head_seq;
+
+  smp_wmb();
+  WRITE_ONCE(header->update_count, header->update_count + 1);
+}
+
+/*
+** Allocate the mapped view of the still empty ring at module load. ->mmap
+** runs with mmap_lock held, and readers fault on user memory with
+** buffer_mutex held, so aesd_mmap must not take buffer_mutex to do this.
+*/
+static int aesd_mmap_alloc(struct aesd_dev *dev) {
+  if (mmap_data_size == 0) {
+    return 0;
+  }
+
+  BUILD_BUG_ON(sizeof(struct aesd_mmap_header) > PAGE_SIZE);
+  size_t data_size = PAGE_ALIGN(mmap_data_size);
+  struct aesd_mmap_header *header =
+      (struct aesd_mmap_header *)vmalloc_user(PAGE_SIZE + data_size);
+  if (!header) {
+    return -ENOMEM;
+  }
+
+  header->data_offset = PAGE_SIZE;
+  header->data_size = data_size;
+  header->tail_seq = aesd_circular_buffer_first_seq(&dev->buffer);
+  header->head_seq = header->tail_seq;
+
+  dev->mmap_header = header;
+  dev->mmap_head = 0;
+  dev->mmap_tail = 0;
+  return 0;
+}
+
 int aesd_open(struct inode *inode, struct file *filp) {
   PDEBUG("open");
 
   /* add device information to other method */
-  struct aesd_dev *dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-  filp->private_data = (void *)dev;
+  struct aesd_file *file = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+  if (!file) {
+    return -ENOMEM;
+  }
+  file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+  filp->private_data = (void *)file;
+
+  // start reading at the oldest record still in the ring
+  if (aesd_lock(file->dev, NULL)) {
+    kfree(file);
+    return -EINTR;
+  }
+  filp->f_pos = aesd_circular_buffer_first_offset(&file->dev->buffer);
+  aesd_unlock(file->dev);
 
   return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp) {
   PDEBUG("release");
-  /**
-   * TODO: handle release
-   */
+  kfree(filp->private_data);
   return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                  loff_t *f_pos) {
+static size_t aesd_copy_to_iter(void *ctx, const char *src, size_t size) {
+  PDEBUG("Read Offsetted: %.*s", (int)size, src);
+  return copy_to_iter(src, size, (struct iov_iter *)ctx);
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+  struct file *filp = iocb->ki_filp;
   ssize_t retval = 0;
-  PDEBUG("read %zu bytes with offset %lld", count, *f_pos);
+  uint64_t seq = 0;
+  uint64_t lock_wait_ns = 0;
+  PDEBUG("read %zu bytes with offset %lld", iov_iter_count(to), iocb->ki_pos);
+  trace_aesd_read_enter(iov_iter_count(to), iocb->ki_pos);
 
-  struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-  if (mutex_lock_interruptible(&dev->buffer_mutex)) {
-    return -EINTR;
+  struct aesd_file *file = (struct aesd_file *)filp->private_data;
+  struct aesd_dev *dev = file->dev;
+  if (aesd_lock(dev, &lock_wait_ns)) {
+    retval = -EINTR;
+    goto out_unlocked;
+  }
+  ++dev->stats.reads;
+  seq = dev->buffer.total_entries;
+
+  // skip the records a previous read reported as overwritten
+  if (file->resume_pos > iocb->ki_pos) {
+    iocb->ki_pos = file->resume_pos;
   }
 
   size_t entry_offset;
-  struct aesd_buffer_entry *entry =
-      aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos,
-                                                      &entry_offset);
-  if (!entry) {
-    retval = 0;
-    goto out;
+  struct aesd_buffer_entry *entry;
+  for (;;) {
+    /*
+    ** the records at f_pos were overwritten, possibly while waiting: report
+    ** it once, like /dev/kmsg, and resume at the oldest record on the next
+    ** read. The VFS drops ki_pos on errors, so the file remembers it.
+    */
+    uint64_t first_offset = aesd_circular_buffer_first_offset(&dev->buffer);
+    if (iocb->ki_pos < first_offset) {
+      file->resume_pos = first_offset;
+      retval = -EPIPE;
+      goto out;
+    }
+
+    entry = aesd_circular_buffer_find_entry_for_offset(
+        &dev->buffer, iocb->ki_pos, &entry_offset);
+    if (entry) {
+      break;
+    }
+    if (!file->follow) {
+      retval = 0;
+      goto out;
+    }
+
+    // wait for the next commit and look again
+    seq = dev->buffer.total_entries;
+    aesd_unlock(dev);
+    if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)) {
+      retval = -EAGAIN;
+      goto out_unlocked;
+    }
+    if (wait_event_interruptible(dev->read_queue,
+                                 READ_ONCE(dev->buffer.total_entries) !=
+                                     seq)) {
+      retval = -ERESTARTSYS;
+      goto out_unlocked;
+    }
+    if (aesd_lock(dev, &lock_wait_ns)) {
+      retval = -EINTR;
+      goto out_unlocked;
+    }
   }
+  seq = aesd_circular_buffer_entry_seq(&dev->buffer, entry);
 
-  size_t size_offsetted = entry->size - entry_offset;
-  const char *buffptr = entry->buffptr + entry_offset;
-  PDEBUG("Read: %.*s", (int)entry->size, entry->buffptr);
-  PDEBUG("Read Offsetted: %.*s", (int)size_offsetted, buffptr);
-  if (copy_to_user(buf, buffptr, size_offsetted)) {
+  // fill the whole request, one contiguous copy per record
+  size_t copied = aesd_circular_buffer_copy_range_to(
+      &dev->buffer, iocb->ki_pos, iov_iter_count(to), aesd_copy_to_iter, to);
+  iocb->ki_pos += copied;
+  retval = copied;
+  if (!copied && iov_iter_count(to)) {
     retval = -EFAULT;
-    goto out;
   }
 
-  *f_pos += size_offsetted;
-  retval = size_offsetted;
-
 out:
-  mutex_unlock(&dev->buffer_mutex);
+  if (retval >= 0) {
+    file->resume_pos = 0;
+    dev->stats.read_bytes += retval;
+  }
+  aesd_unlock(dev);
+out_unlocked:
+  trace_aesd_read_exit(retval, iocb->ki_pos, seq, lock_wait_ns);
   return retval;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                   loff_t *f_pos) {
-  ssize_t retval = -ENOMEM;
-  PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
+/*
+** Smallest allocation made for a partial record, and the largest one kept
+** around for the next record once its contents are committed
+*/
+#define AESD_PARTIAL_MIN_CAPACITY 64
+#define AESD_PARTIAL_KEEP_CAPACITY PAGE_SIZE
 
-  struct aesd_dev *dev = (struct aesd_dev *)filp->private_data;
-  if (mutex_lock_interruptible(&dev->buffer_mutex)) {
-    return -EINTR;
+/*
+** Make room for @param size bytes in the partial record buffer. The capacity
+** doubles on each growth so appending costs amortized O(1) per byte instead
+** of copying the whole pending record on every write.
+*/
+static int aesd_partial_reserve(struct aesd_dev *dev, size_t size) {
+  if (size <= dev->partial_capacity) {
+    return 0;
   }
 
-  // if no partial entry, than buffer_size = count
-  size_t buffer_size = count + dev->partial_entry.size;
-  char *buffptr = (char *)kmalloc(buffer_size, GFP_KERNEL);
-  if (!buffptr) {
-    goto out;
+  size_t capacity =
+      max_t(size_t, dev->partial_capacity, AESD_PARTIAL_MIN_CAPACITY);
+  while (capacity < size) {
+    capacity *= 2;
   }
 
-  // give space to partial buffer if exists
-  if (copy_from_user(buffptr + dev->partial_entry.size, buf, count)) {
-    retval = -EFAULT;
-    kfree(buffptr);
-    goto out;
+  char *buf = (char *)krealloc(dev->partial_buf, capacity, GFP_KERNEL);
+  if (!buf) {
+    atomic64_inc(&dev->stats.alloc_failures);
+    return -ENOMEM;
   }
 
-  /*
-  ** if there's a partial entry
-  ** copy partial entry to new buffer
-  ** free partial entry buffer
-  ** reset partial_entry state
-  */
-  if (dev->partial_entry.buffptr != NULL) {
-    memcpy(buffptr, dev->partial_entry.buffptr, dev->partial_entry.size);
-    PDEBUG("Free partial write %.*s", (int)dev->partial_entry.size,
-           dev->partial_entry.buffptr);
-    kfree(dev->partial_entry.buffptr);
+  dev->partial_buf = buf;
+  dev->partial_capacity = capacity;
+  return 0;
+}
 
-    // reset state
-    dev->partial_entry.buffptr = NULL;
-    dev->partial_entry.size = 0;
+/*
+** Drop the first @param size bytes of the partial record buffer, releasing
+** it once empty if it grew past what is worth keeping for the next record
+*/
+static void aesd_partial_consume(struct aesd_dev *dev, size_t size) {
+  dev->partial_size -= size;
+  memmove(dev->partial_buf, dev->partial_buf + size, dev->partial_size);
+
+  if (dev->partial_size == 0 &&
+      dev->partial_capacity > AESD_PARTIAL_KEEP_CAPACITY) {
+    kfree(dev->partial_buf);
+    dev->partial_buf = NULL;
+    dev->partial_capacity = 0;
   }
+}
 
+/*
+** Add @param buffptr, a record of @param size bytes from aesd_record_alloc,
+** to the ring. Caller holds buffer_mutex.
+*/
+static void aesd_commit_record(struct aesd_dev *dev, char *buffptr,
+                               size_t size) {
   struct aesd_buffer_entry entry = {//
                                     .buffptr = buffptr,
-                                    .size = buffer_size};
+                                    .size = size};
+
+  PDEBUG("Wrote: %.*s", (int)size, buffptr);
+  struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+  size_t nevicted =
+      aesd_circular_buffer_add_entry_evict(&dev->buffer, &entry, evicted);
+  aesd_mmap_commit(dev, &entry, dev->buffer.total_entries - 1);
+  ++dev->stats.records;
+  dev->stats.evictions += nevicted;
+  aesd_record_free_batch(evicted, nevicted);
+}
+
+/*
+** Commit every record completed by the bytes appended to the partial buffer
+** after its first @param old_size bytes, each '\n' ending one record.
+** Caller holds buffer_mutex.
+** @return the number of appended bytes accepted: all of them, fewer when a
+** record could not be allocated after others were committed, or -ENOMEM when
+** none could
+*/
+static ssize_t aesd_partial_commit(struct aesd_dev *dev, size_t old_size) {
+  ssize_t written = dev->partial_size - old_size;
+  char *end = dev->partial_buf + dev->partial_size;
+  char *scan = dev->partial_buf + old_size;
+  size_t start = 0;
+  char *newline;
+
+  while ((newline = (char *)memchr(scan, '\n', end - scan))) {
+    size_t size = newline + 1 - (dev->partial_buf + start);
+    char *buffptr = aesd_record_alloc(dev, size);
+    if (!buffptr) {
+      if (start == 0) {
+        dev->partial_size = old_size;
+        return -ENOMEM;
+      }
+      // keep the committed records and give the rest of the write back
+      written = start - old_size;
+      dev->partial_size = start;
+      break;
+    }
+
+    memcpy(buffptr, dev->partial_buf + start, size);
+    aesd_commit_record(dev, buffptr, size);
+    // only the first record can start with bytes of earlier writes
+    if (start < old_size) {
+      ++dev->stats.partial_commits;
+    }
+    start += size;
+    scan = newline + 1;
+  }
+
+  aesd_partial_consume(dev, start);
+  if (dev->partial_size) {
+    PDEBUG("Partial write: %.*s", (int)dev->partial_size, dev->partial_buf);
+  }
+  return written;
+}
+
+/*
+** Append @param count bytes from @param buf to the partial record buffer and
+** commit the records they complete. Caller holds buffer_mutex.
+** @return see aesd_partial_commit, or -EFBIG when the pending record would
+** grow past the byte budget
+*/
+static ssize_t aesd_partial_append(struct aesd_dev *dev, const char *buf,
+                                   size_t count) {
+  size_t old_size = dev->partial_size;
+  const char *newline = (const char *)memchr(buf, '\n', count);
 
   /*
-   * if is not a partial entry
-   * push to circular buffer
-   * */
-  if (buffptr[buffer_size - 1] == '\n') {
+  ** the pending record grows by the bytes up to the first '\n', and must
+  ** leave room for one when there is none so it can still be completed
+  */
+  if (aesd_record_too_large(
+          dev, old_size + (newline ? newline + 1 - buf : count + 1))) {
+    return -EFBIG;
+  }
+  if (aesd_partial_reserve(dev, old_size + count)) {
+    return -ENOMEM;
+  }
+  memcpy(dev->partial_buf + old_size, buf, count);
+  dev->partial_size += count;
+  return aesd_partial_commit(dev, old_size);
+}
+
+/*
+** Commit the records staged on every CPU, oldest first on each of them, and
+** set the result of each writer. A record written while a partial one is
+** pending completes that one instead, as it would have without staging.
+** Caller holds buffer_mutex.
+** @return the published records, for aesd_complete_staged once the lock is
+** released so their writers do not wake up only to find it taken
+*/
+static struct llist_node *aesd_publish_staged(struct aesd_dev *dev) {
+  uint64_t seq = dev->buffer.total_entries;
+  struct llist_node *published = NULL;
+  int npublished = 0;
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    struct llist_node *list =
+        llist_del_all(per_cpu_ptr(dev->staged_records, cpu));
+    struct aesd_staged_record *staged, *next;
+
+    llist_for_each_entry_safe(staged, next, llist_reverse_order(list), node) {
+      ++dev->stats.writes;
+      staged->seq = dev->buffer.total_entries;
+      if (dev->partial_size) {
+        staged->result =
+            aesd_partial_append(dev, staged->buffptr, staged->size);
+        aesd_record_free(staged->buffptr, staged->size);
+      } else {
+        aesd_commit_record(dev, staged->buffptr, staged->size);
+        staged->result = staged->size;
+      }
+      if (staged->result > 0) {
+        dev->stats.write_bytes += staged->result;
+      }
+      staged->node.next = published;
+      published = &staged->node;
+      ++npublished;
+    }
+  }
+  atomic_sub(npublished, &dev->staged_count);
+
+  if (dev->buffer.total_entries != seq) {
+    wake_up_interruptible(&dev->read_queue);
+  }
+  return published;
+}
 
-    PDEBUG("Wrote: %.*s", (int)buffer_size, buffptr);
-    struct aesd_buffer_entry old_entry =
-        aesd_circular_buffer_add_entry(&dev->buffer, &entry);
-    if (old_entry.buffptr) {
-      PDEBUG("Free overwritten: %.*s", (int)old_entry.size, old_entry.buffptr);
-      kfree(old_entry.buffptr);
+/*
+** Hand the records returned by aesd_publish_staged back to their writers
+*/
+static void aesd_complete_staged(struct llist_node *published) {
+  struct aesd_staged_record *staged, *next;
+
+  llist_for_each_entry_safe(staged, next, published, node) {
+    complete(&staged->done);
+    if (refcount_dec_and_test(&staged->refs)) {
+      kfree(staged);
     }
-  } else { // current entry is a partial
-    dev->partial_entry = entry;
-    PDEBUG("Partial write: %.*s", (int)entry.size, entry.buffptr);
+  }
+}
+
+/*
+** Stage the complete record @param buffptr of @param size bytes on this CPU
+** and wait until it is in the ring. The task taking buffer_mutex publishes
+** every staged record at once, and so does the task releasing it, so a writer
+** that finds the lock taken only sleeps until its record is published,
+** without ever taking the lock itself.
+** @return the bytes written or a negative error, and the sequence number the
+** record got in @param seq. -EINTR means the writer was killed while waiting:
+** its record is staged already and may still be committed after it returns.
+*/
+static ssize_t aesd_stage_record(struct aesd_dev *dev, char *buffptr,
+                                 size_t size, uint64_t *seq,
+                                 uint64_t *lock_wait_ns) {
+  struct aesd_staged_record *staged = (struct aesd_staged_record *)kmalloc(
+      sizeof(struct aesd_staged_record), GFP_KERNEL);
+  ssize_t retval;
+
+  if (!staged) {
+    atomic64_inc(&dev->stats.alloc_failures);
+    aesd_record_free(buffptr, size);
+    return -ENOMEM;
+  }
+  staged->buffptr = buffptr;
+  staged->size = size;
+  init_completion(&staged->done);
+  // one reference for this writer, one for the task publishing the record
+  refcount_set(&staged->refs, 2);
+
+  /*
+  ** counted once on the list, so a positive count always means a record to
+  ** publish; the last writer to count its record then either gets the lock
+  ** or is seen by the task releasing it
+  */
+  llist_add(&staged->node, raw_cpu_ptr(dev->staged_records));
+  atomic_inc(&dev->staged_count);
+  smp_mb__after_atomic();
+  if (mutex_trylock(&dev->buffer_mutex)) {
+    aesd_lock_acquired(dev, false, 0, lock_wait_ns);
+    struct llist_node *published = aesd_publish_staged(dev);
+    aesd_unlock(dev);
+    aesd_complete_staged(published);
+  }
+
+  /*
+  ** a killed writer cannot take its record back from the list, so it leaves
+  ** it to be published without it and the write may still take effect; the
+  ** reference it drops keeps the node alive until then
+  */
+  if (wait_for_completion_killable(&staged->done)) {
+    retval = -EINTR;
+  } else {
+    *seq = staged->seq;
+    retval = staged->result;
+  }
+  if (refcount_dec_and_test(&staged->refs)) {
+    kfree(staged);
+  }
+  return retval;
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+  ssize_t retval;
+  size_t count = iov_iter_count(from);
+  uint64_t seq = 0;
+  uint64_t lock_wait_ns = 0;
+  PDEBUG("write %zu bytes with offset %lld", count, iocb->ki_pos);
+  trace_aesd_write_enter(count, iocb->ki_pos);
+
+  if (count == 0) {
+    retval = 0;
+    goto out;
   }
 
-  *f_pos += buffer_size;
-  retval = count;
+  struct aesd_dev *dev =
+      ((struct aesd_file *)iocb->ki_filp->private_data)->dev;
+
+  if (aesd_record_too_large(dev, count)) {
+    retval = -EFBIG;
+    goto out;
+  }
+
+  // allocate and copy before taking any lock
+  char *buffptr = aesd_record_alloc(dev, count);
+  if (!buffptr) {
+    retval = -ENOMEM;
+    goto out;
+  }
+
+  if (!copy_from_iter_full(buffptr, count, from)) {
+    retval = -EFAULT;
+    aesd_record_free(buffptr, count);
+    goto out;
+  }
+
+  // most writes carry exactly one record, which is already in its place
+  if (memchr(buffptr, '\n', count) == buffptr + count - 1) {
+    retval = aesd_stage_record(dev, buffptr, count, &seq, &lock_wait_ns);
+    goto out;
+  }
+
+  // several records or a partial one
+  if (aesd_lock(dev, &lock_wait_ns)) {
+    retval = -EINTR;
+    aesd_record_free(buffptr, count);
+    goto out;
+  }
+  ++dev->stats.writes;
+  seq = dev->buffer.total_entries;
+
+  retval = aesd_partial_append(dev, buffptr, count);
+  aesd_record_free(buffptr, count);
+
+  if (retval > 0) {
+    dev->stats.write_bytes += retval;
+  }
+  if (dev->buffer.total_entries != seq) {
+    wake_up_interruptible(&dev->read_queue);
+  }
+  aesd_unlock(dev);
 
 out:
-  mutex_unlock(&dev->buffer_mutex);
+  if (retval > 0) {
+    iocb->ki_pos += retval;
+  }
+  trace_aesd_write_exit(retval, iocb->ki_pos, seq, lock_wait_ns);
   return retval;
 }
 
+/*
+** File positions are offsets in the stream of every byte ever written, so
+** they keep designating the same byte after old records are overwritten.
+** SEEK_DATA moves a position that fell behind to the oldest record.
+*/
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence) {
-  struct aesd_dev *dev = filp->private_data;
+  struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
+  uint64_t lock_wait_ns = 0;
   loff_t newpos;
+  trace_aesd_llseek_enter(off, whence);
 
   switch (whence) {
-  case 0: /* SEEK_SET */
+  case SEEK_SET:
     newpos = off;
     break;
 
-  case 1: /* SEEK_CUR */
+  case SEEK_CUR:
     newpos = filp->f_pos + off;
     break;
 
-  case 2: /* SEEK_END */
-    newpos = dev->buffer.size + off;
-    return -EINVAL;
+  case SEEK_END:
+    if (aesd_lock(dev, &lock_wait_ns)) {
+      newpos = -EINTR;
+      goto out;
+    }
+    newpos = dev->buffer.total_size + off;
+    aesd_unlock(dev);
+    break;
+
+  case SEEK_DATA:
+    if (aesd_lock(dev, &lock_wait_ns)) {
+      newpos = -EINTR;
+      goto out;
+    }
+    newpos = max_t(loff_t, off,
+                   aesd_circular_buffer_first_offset(&dev->buffer));
+    if (newpos >= dev->buffer.total_size) {
+      newpos = -ENXIO;
+    }
+    aesd_unlock(dev);
+    if (newpos < 0) {
+      goto out;
+    }
     break;
 
   default: /* can't happen */
-    return -EINVAL;
+    newpos = -EINVAL;
+    goto out;
   }
 
-  if (newpos < 0)
-    return -EINVAL;
+  if (newpos < 0) {
+    newpos = -EINVAL;
+    goto out;
+  }
   PDEBUG("seek pos to: %lld", newpos);
   filp->f_pos = newpos;
+  // the new position is read as is, even if it fell behind again
+  ((struct aesd_file *)filp->private_data)->resume_pos = 0;
+
+out:
+  trace_aesd_llseek_exit(newpos, lock_wait_ns);
   return newpos;
 }
 
+/*
+** Copy the records described by @param uarg from user space, outside of any
+** lock, then commit them all in one critical section
+*/
+static long aesd_append_records(struct aesd_dev *dev,
+                                struct aesd_append __user *uarg,
+                                uint64_t *lock_wait_ns) {
+  struct aesd_append append;
+  struct aesd_record *records;
+  struct aesd_buffer_entry *entries;
+  long retval = 0;
+  uint32_t i;
+
+  if (copy_from_user(&append, uarg, sizeof(struct aesd_append))) {
+    return -EFAULT;
+  }
+
+  if (append.count == 0 || append.count > AESDCHAR_APPEND_MAX_RECORDS ||
+      append.flags != 0) {
+    return -EINVAL;
+  }
+
+  records = kvmalloc_array(append.count, sizeof(struct aesd_record),
+                           GFP_KERNEL);
+  entries = kvcalloc(append.count, sizeof(struct aesd_buffer_entry),
+                     GFP_KERNEL);
+  if (!records || !entries) {
+    retval = -ENOMEM;
+    goto out;
+  }
+
+  if (copy_from_user(records, u64_to_user_ptr(append.records),
+                     append.count * sizeof(struct aesd_record))) {
+    retval = -EFAULT;
+    goto out;
+  }
+
+  for (i = 0; i < append.count; ++i) {
+    if (records[i].size == 0 || records[i].size > MAX_RW_COUNT ||
+        aesd_record_too_large(dev, records[i].size)) {
+      retval = -EINVAL;
+      goto out;
+    }
+
+    char *buffptr = aesd_record_alloc(dev, records[i].size);
+    if (!buffptr) {
+      retval = -ENOMEM;
+      goto out;
+    }
+    entries[i].buffptr = buffptr;
+    entries[i].size = records[i].size;
+
+    if (copy_from_user(buffptr, u64_to_user_ptr(records[i].buf),
+                       records[i].size)) {
+      retval = -EFAULT;
+      goto out;
+    }
+  }
+
+  if (aesd_lock(dev, lock_wait_ns)) {
+    retval = -EINTR;
+    goto out;
+  }
+  append.first_seq = dev->buffer.total_entries;
+  for (i = 0; i < append.count; ++i) {
+    aesd_commit_record(dev, (char *)entries[i].buffptr, entries[i].size);
+    entries[i].buffptr = NULL;
+  }
+  wake_up_interruptible(&dev->read_queue);
+  aesd_unlock(dev);
+
+  if (put_user(append.first_seq, &uarg->first_seq)) {
+    retval = -EFAULT;
+  }
+
+out:
+  if (entries) {
+    for (i = 0; i < append.count; ++i) {
+      aesd_record_free(entries[i].buffptr, entries[i].size);
+    }
+  }
+  kvfree(entries);
+  kvfree(records);
+  return retval;
+}
+
+/*
+** Fill @param uarg with the ring layout, and the sizes of its records when
+** the caller passed an array for them
+*/
+static long aesd_get_info(struct aesd_dev *dev, struct aesd_info __user *uarg,
+                          uint64_t *lock_wait_ns) {
+  struct aesd_info info;
+  uint64_t *sizes = NULL;
+  long retval = 0;
+  size_t i;
+  struct aesd_buffer_entry *entry;
+
+  if (copy_from_user(&info, uarg, sizeof(struct aesd_info))) {
+    return -EFAULT;
+  }
+
+  if (info.flags != 0) {
+    return -EINVAL;
+  }
+
+  if (!info.sizes) {
+    info.sizes_len = 0;
+  }
+  info.sizes_len = min_t(uint32_t, info.sizes_len,
+                         AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+  if (info.sizes_len) {
+    sizes = kvmalloc_array(info.sizes_len, sizeof(uint64_t), GFP_KERNEL);
+    if (!sizes) {
+      return -ENOMEM;
+    }
+  }
+
+  if (aesd_lock(dev, lock_wait_ns)) {
+    kvfree(sizes);
+    return -EINTR;
+  }
+  info.capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+  info.count = aesd_circular_buffer_count(&dev->buffer);
+  info.total_bytes = dev->buffer.size;
+  info.first_seq = aesd_circular_buffer_first_seq(&dev->buffer);
+  info.last_seq = dev->buffer.total_entries - 1;
+  info.first_offset = aesd_circular_buffer_first_offset(&dev->buffer);
+
+  info.sizes_len = min(info.sizes_len, info.count);
+  AESD_CIRCULAR_BUFFER_FOREACH_IN_ORDER(entry, &dev->buffer, i) {
+    if (i == info.sizes_len) {
+      break;
+    }
+    sizes[i] = entry->size;
+  }
+  aesd_unlock(dev);
+
+  if (info.sizes_len &&
+      copy_to_user(u64_to_user_ptr(info.sizes), sizes,
+                   info.sizes_len * sizeof(uint64_t))) {
+    retval = -EFAULT;
+  } else if (copy_to_user(uarg, &info, sizeof(struct aesd_info))) {
+    retval = -EFAULT;
+  }
+
+  kvfree(sizes);
+  return retval;
+}
+
+/*
+** Copy to the user space cursor at @param ctx, moved past the bytes copied
+*/
+static size_t aesd_copy_to_user(void *ctx, const char *src, size_t size) {
+  char __user **dest = (char __user **)ctx;
+  size_t copied = size - copy_to_user(*dest, src, size);
+
+  *dest += copied;
+  return copied;
+}
+
+/*
+** Write a snapshot of the ring to the buffer described by @param uarg,
+** copying each record straight from the ring
+*/
+static long aesd_export_snapshot(struct aesd_dev *dev,
+                                 struct aesd_snapshot __user *uarg,
+                                 uint64_t *lock_wait_ns) {
+  struct aesd_snapshot snapshot;
+  struct aesd_snapshot_header header = {//
+                                        .magic = AESDCHAR_SNAPSHOT_MAGIC,
+                                        .version = AESDCHAR_SNAPSHOT_VERSION};
+  long retval = 0;
+  size_t i;
+  struct aesd_buffer_entry *entry;
+
+  if (copy_from_user(&snapshot, uarg, sizeof(struct aesd_snapshot))) {
+    return -EFAULT;
+  }
+
+  if (aesd_lock(dev, lock_wait_ns)) {
+    return -EINTR;
+  }
+  header.count = aesd_circular_buffer_count(&dev->buffer);
+  header.first_seq = aesd_circular_buffer_first_seq(&dev->buffer);
+  header.first_offset = aesd_circular_buffer_first_offset(&dev->buffer);
+
+  size_t sizes_len = header.count * sizeof(uint64_t);
+  uint64_t size = sizeof(header) + sizes_len + dev->buffer.size;
+  if (snapshot.size < size) {
+    retval = -ERANGE;
+    goto out;
+  }
+
+  char __user *buf = u64_to_user_ptr(snapshot.buf);
+  char __user *data = buf + sizeof(header) + sizes_len;
+  if (copy_to_user(buf, &header, sizeof(header))) {
+    retval = -EFAULT;
+    goto out;
+  }
+  buf += sizeof(header);
+
+  AESD_CIRCULAR_BUFFER_FOREACH_IN_ORDER(entry, &dev->buffer, i) {
+    uint64_t entry_size = entry->size;
+
+    if (put_user(entry_size, (uint64_t __user *)buf)) {
+      retval = -EFAULT;
+      goto out;
+    }
+    buf += sizeof(uint64_t);
+  }
+
+  if (aesd_circular_buffer_copy_range_to(&dev->buffer, header.first_offset,
+                                         dev->buffer.size, aesd_copy_to_user,
+                                         &data) != dev->buffer.size) {
+    retval = -EFAULT;
+  }
+
+out:
+  aesd_unlock(dev);
+
+  if (retval == 0 || retval == -ERANGE) {
+    if (put_user(size, &uarg->size)) {
+      retval = -EFAULT;
+    }
+  }
+  return retval;
+}
+
+/*
+** Fill the ring, which must be empty, with the snapshot described by
+** @param uarg. The records are allocated and copied before taking the lock.
+*/
+static long aesd_import_snapshot(struct aesd_dev *dev,
+                                 struct aesd_snapshot __user *uarg,
+                                 uint64_t *lock_wait_ns) {
+  struct aesd_snapshot snapshot;
+  struct aesd_snapshot_header header;
+  struct aesd_buffer_entry *entries = NULL;
+  uint64_t *sizes = NULL;
+  long retval = 0;
+  uint32_t i;
+
+  if (copy_from_user(&snapshot, uarg, sizeof(struct aesd_snapshot))) {
+    return -EFAULT;
+  }
+
+  char __user *buf = u64_to_user_ptr(snapshot.buf);
+  if (snapshot.size < sizeof(header)) {
+    return -EINVAL;
+  }
+  if (copy_from_user(&header, buf, sizeof(header))) {
+    return -EFAULT;
+  }
+
+  if (header.magic != AESDCHAR_SNAPSHOT_MAGIC ||
+      header.version != AESDCHAR_SNAPSHOT_VERSION || header.flags != 0 ||
+      header.count > AESDCHAR_APPEND_MAX_RECORDS) {
+    return -EINVAL;
+  }
+
+  if (header.count) {
+    sizes = kvmalloc_array(header.count, sizeof(uint64_t), GFP_KERNEL);
+    entries = kvcalloc(header.count, sizeof(struct aesd_buffer_entry),
+                       GFP_KERNEL);
+    if (!sizes || !entries) {
+      retval = -ENOMEM;
+      goto out;
+    }
+  }
+
+  size_t sizes_len = header.count * sizeof(uint64_t);
+  uint64_t size = sizeof(header) + sizes_len;
+  if (snapshot.size < size) {
+    retval = -EINVAL;
+    goto out;
+  }
+  if (copy_from_user(sizes, buf + sizeof(header), sizes_len)) {
+    retval = -EFAULT;
+    goto out;
+  }
+
+  for (i = 0; i < header.count; ++i) {
+    if (sizes[i] == 0 || sizes[i] > MAX_RW_COUNT ||
+        aesd_record_too_large(dev, sizes[i])) {
+      retval = -EINVAL;
+      goto out;
+    }
+    size += sizes[i];
+  }
+  if (size != snapshot.size) {
+    retval = -EINVAL;
+    goto out;
+  }
+
+  // the positions and sequence numbers of the records must fit loff_t and u64
+  uint64_t records_size = size - sizeof(header) - sizes_len;
+  if (records_size > MAX_LFS_FILESIZE ||
+      header.first_offset > MAX_LFS_FILESIZE - records_size ||
+      header.first_seq > U64_MAX - header.count) {
+    retval = -EINVAL;
+    goto out;
+  }
+
+  char __user *data = buf + sizeof(header) + sizes_len;
+  for (i = 0; i < header.count; ++i) {
+    char *buffptr = aesd_record_alloc(dev, sizes[i]);
+    if (!buffptr) {
+      retval = -ENOMEM;
+      goto out;
+    }
+    entries[i].buffptr = buffptr;
+    entries[i].size = sizes[i];
+
+    if (copy_from_user(buffptr, data, sizes[i])) {
+      retval = -EFAULT;
+      goto out;
+    }
+    data += sizes[i];
+  }
+
+  if (aesd_lock(dev, lock_wait_ns)) {
+    retval = -EINTR;
+    goto out;
+  }
+  if (dev->partial_size ||
+      !aesd_circular_buffer_set_origin(&dev->buffer, header.first_seq,
+                                       header.first_offset)) {
+    aesd_unlock(dev);
+    retval = -EBUSY;
+    goto out;
+  }
+  for (i = 0; i < header.count; ++i) {
+    aesd_commit_record(dev, (char *)entries[i].buffptr, entries[i].size);
+    entries[i].buffptr = NULL;
+  }
+  wake_up_interruptible(&dev->read_queue);
+  aesd_unlock(dev);
+
+out:
+  if (entries) {
+    for (i = 0; i < header.count; ++i) {
+      aesd_record_free(entries[i].buffptr, entries[i].size);
+    }
+  }
+  kvfree(entries);
+  kvfree(sizes);
+  return retval;
+}
+
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
 
   PDEBUG("ioctl: cmd: %d arg: %lul", cmd, arg);
-  int retval = 0;
-  uint8_t index;
+  struct aesd_file *file = (struct aesd_file *)filp->private_data;
+  struct aesd_dev *dev = file->dev;
+  long retval = 0;
+  uint64_t lock_wait_ns = 0;
   struct aesd_buffer_entry *entry;
-  long offset = 0;
+  size_t offset;
+  loff_t pos;
 
   struct aesd_seekto seekto_arg;
+  uint32_t follow;
+  trace_aesd_ioctl_enter(cmd, arg);
 
   switch (cmd) {
   case AESDCHAR_IOCSEEKTO:
-    copy_from_user(&seekto_arg, (void __user *)arg, sizeof(struct aesd_seekto));
+    if (copy_from_user(&seekto_arg, (void __user *)arg,
+                       sizeof(struct aesd_seekto))) {
+      retval = -EFAULT;
+      break;
+    }
 
     PDEBUG("ioctl: iocseekto cmd: %d offset: %d", seekto_arg.write_cmd,
            seekto_arg.write_cmd_offset);
 
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, index) {
-      if (index == seekto_arg.write_cmd) {
-        break;
-      }
-      offset += entry->size;
+    if (aesd_lock(dev, &lock_wait_ns)) {
+      retval = -EINTR;
+      break;
+    }
+    entry = aesd_circular_buffer_find_fpos_for_entry(
+        &dev->buffer, seekto_arg.write_cmd, &offset);
+    if (!entry || seekto_arg.write_cmd_offset >= entry->size) {
+      aesd_unlock(dev);
+      retval = -EINVAL;
+      break;
     }
+    pos = aesd_circular_buffer_first_offset(&dev->buffer) + offset +
+          seekto_arg.write_cmd_offset;
+    aesd_unlock(dev);
 
-    offset += seekto_arg.write_cmd_offset;
-    retval = aesd_llseek(filp, offset, 1);
+    retval = aesd_llseek(filp, pos, SEEK_SET);
+    break;
+  case AESDCHAR_IOCFOLLOW:
+    if (get_user(follow, (uint32_t __user *)arg)) {
+      retval = -EFAULT;
+      break;
+    }
+    file->follow = follow != 0;
+    break;
+  case AESDCHAR_IOCAPPEND:
+    // the same error write() gives on a file not opened for writing
+    if (!(filp->f_mode & FMODE_WRITE)) {
+      retval = -EBADF;
+      break;
+    }
+    retval = aesd_append_records(dev, (struct aesd_append __user *)arg,
+                                 &lock_wait_ns);
+    break;
+  case AESDCHAR_IOCGINFO:
+    retval = aesd_get_info(dev, (struct aesd_info __user *)arg, &lock_wait_ns);
+    break;
+  case AESDCHAR_IOCEXPORT:
+    if (!(filp->f_mode & FMODE_READ)) {
+      retval = -EBADF;
+      break;
+    }
+    retval = aesd_export_snapshot(dev, (struct aesd_snapshot __user *)arg,
+                                  &lock_wait_ns);
+    break;
+  case AESDCHAR_IOCIMPORT:
+    if (!(filp->f_mode & FMODE_WRITE)) {
+      retval = -EBADF;
+      break;
+    }
+    retval = aesd_import_snapshot(dev, (struct aesd_snapshot __user *)arg,
+                                  &lock_wait_ns);
     break;
   default:
-    return -ENOTTY;
+    retval = -ENOTTY;
   }
+
+  trace_aesd_ioctl_exit(cmd, retval, lock_wait_ns);
   return retval;
 }
 
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma) {
+  struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
+
+  if (!dev->mmap_header) {
+    return -ENODEV;
+  }
+
+  // the view is shared by every reader, nobody may write to it
+  if (vma->vm_flags & VM_WRITE) {
+    return -EACCES;
+  }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+  vm_flags_clear(vma, VM_MAYWRITE);
+#else
+  vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+  return remap_vmalloc_range(vma, dev->mmap_header, vma->vm_pgoff);
+}
+
+/*
+** The file is readable when a record is available where the next read starts,
+** or when its position fell behind and that read reports it, so poll/epoll
+** users only wake up when a read has something to say
+*/
+__poll_t aesd_poll(struct file *filp, poll_table *wait) {
+  struct aesd_file *file = (struct aesd_file *)filp->private_data;
+  struct aesd_dev *dev = file->dev;
+  __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+  size_t entry_offset;
+
+  poll_wait(filp, &dev->read_queue, wait);
+
+  if (aesd_lock(dev, NULL)) {
+    return mask;
+  }
+  loff_t pos = max(filp->f_pos, file->resume_pos);
+  if (pos < aesd_circular_buffer_first_offset(&dev->buffer) ||
+      aesd_circular_buffer_find_entry_for_offset(&dev->buffer, pos,
+                                                 &entry_offset)) {
+    mask |= EPOLLIN | EPOLLRDNORM;
+  }
+  aesd_unlock(dev);
+
+  return mask;
+}
+
+/*
+** debugfs/aesdchar/stats, one "name value" pair per line
+*/
+static int aesd_stats_show(struct seq_file *s, void *unused) {
+  struct aesd_dev *dev = (struct aesd_dev *)s->private;
+  struct aesd_stats stats;
+
+  // plain mutex_lock so reading the counters does not skew them
+  mutex_lock(&dev->buffer_mutex);
+  stats = dev->stats;
+  mutex_unlock(&dev->buffer_mutex);
+  aesd_publish_pending(dev);
+
+  seq_printf(s, "writes %llu\n", stats.writes);
+  seq_printf(s, "write_bytes %llu\n", stats.write_bytes);
+  seq_printf(s, "reads %llu\n", stats.reads);
+  seq_printf(s, "read_bytes %llu\n", stats.read_bytes);
+  seq_printf(s, "records %llu\n", stats.records);
+  seq_printf(s, "partial_commits %llu\n", stats.partial_commits);
+  seq_printf(s, "evictions %llu\n", stats.evictions);
+  seq_printf(s, "lock_acquired %llu\n", stats.lock_acquired);
+  seq_printf(s, "lock_contended %llu\n", stats.lock_contended);
+  seq_printf(s, "lock_wait_ns %llu\n", stats.lock_wait_ns);
+  seq_printf(s, "lock_hold_ns %llu\n", stats.lock_hold_ns);
+  seq_printf(s, "lock_hold_max_ns %llu\n", stats.lock_hold_max_ns);
+  seq_printf(s, "alloc_failures %lld\n",
+             (long long)atomic64_read(&dev->stats.alloc_failures));
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
 struct file_operations aesd_fops = {
     .owner = THIS_MODULE,
-    .read = aesd_read,
+    .read_iter = aesd_read_iter,
     .llseek = aesd_llseek,
-    .write = aesd_write,
+    .write_iter = aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
     .open = aesd_open,
     .release = aesd_release,
     .unlocked_ioctl = aesd_ioctl,
+    .mmap = aesd_mmap,
+    .poll = aesd_poll,
 };
 
 static int aesd_setup_cdev(struct aesd_dev *dev) {
@@ -249,23 +1366,55 @@ int aesd_init_module(void) {
   }
   memset(&aesd_device, 0, sizeof(struct aesd_dev));
 
+  // records are copied to user space, so whitelist the whole object
+  aesd_record_cache = kmem_cache_create_usercopy(
+      "aesd_record", AESD_RECORD_CACHE_SIZE, 0, 0, 0, AESD_RECORD_CACHE_SIZE,
+      NULL);
+  if (!aesd_record_cache) {
+    unregister_chrdev_region(dev, 1);
+    return -ENOMEM;
+  }
+
+  // zeroed memory is an empty llist_head
+  aesd_device.staged_records = alloc_percpu(struct llist_head);
+  if (!aesd_device.staged_records) {
+    kmem_cache_destroy(aesd_record_cache);
+    unregister_chrdev_region(dev, 1);
+    return -ENOMEM;
+  }
+
   aesd_circular_buffer_init(&aesd_device.buffer);
+  aesd_circular_buffer_set_max_size(&aesd_device.buffer, max_buffer_size);
   mutex_init(&aesd_device.buffer_mutex);
+  init_waitqueue_head(&aesd_device.read_queue);
 
-  result = aesd_setup_cdev(&aesd_device);
+  result = aesd_mmap_alloc(&aesd_device);
+  if (!result) {
+    result = aesd_setup_cdev(&aesd_device);
+  }
 
   if (result) {
+    vfree(aesd_device.mmap_header);
+    free_percpu(aesd_device.staged_records);
+    kmem_cache_destroy(aesd_record_cache);
     unregister_chrdev_region(dev, 1);
+    return result;
   }
-  return result;
+
+  // statistics are optional, the device works without debugfs
+  aesd_device.debugfs = debugfs_create_dir("aesdchar", NULL);
+  debugfs_create_file("stats", 0444, aesd_device.debugfs, &aesd_device,
+                      &aesd_stats_fops);
+  return 0;
 }
 
 void aesd_cleanup_module(void) {
   dev_t devno = MKDEV(aesd_major, aesd_minor);
 
+  debugfs_remove_recursive(aesd_device.debugfs);
   cdev_del(&aesd_device.cdev);
 
-  uint8_t index;
+  aesd_ring_index_t index;
   struct aesd_buffer_entry *entry;
 
   while (mutex_lock_interruptible(&aesd_device.buffer_mutex) != 0) {
@@ -273,11 +1422,15 @@ void aesd_cleanup_module(void) {
 
   AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, index) {
     PDEBUG("Free %.*s", (int)entry->size, entry->buffptr);
-    kfree(entry->buffptr);
+    aesd_record_free(entry->buffptr, entry->size);
   }
+  kfree(aesd_device.partial_buf);
+  vfree(aesd_device.mmap_header);
 
   mutex_unlock(&aesd_device.buffer_mutex);
   mutex_destroy(&aesd_device.buffer_mutex);
+  free_percpu(aesd_device.staged_records);
+  kmem_cache_destroy(aesd_record_cache);
   unregister_chrdev_region(devno, 1);
 }
 
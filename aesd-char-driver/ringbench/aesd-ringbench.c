@@ -0,0 +1,277 @@
+/**
+ * @file aesd-ringbench.c
+ * @brief Microbenchmarks of aesd_circular_buffer and aesd_arena_buffer
+ *
+ * Built once per capacity, since AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED and
+ * AESDCHAR_ARENA_MAX_ENTRIES are compile time constants. Times adding entries,
+ * finding the entry of an offset and copying out the whole ring, for several
+ * record sizes and access patterns:
+ * - hot: every operation on the same buffer, which stays in cache
+ * - cold: each operation on the next of enough buffers to overflow the
+ *   caches, so the cost includes fetching the buffer from memory
+ * - sequential or random: the offsets looked up
+ * Each measurement is one CSV row, copies of the whole ring counting one op per
+ * record copied:
+ * capacity,ring,operation,pattern,record_size,ops,ns_per_op
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../aesd-arena-buffer.h"
+#include "../aesd-circular-buffer.h"
+
+#define DEFAULT_ITERATIONS 1000000
+#define COLD_FOOTPRINT (64 * 1024 * 1024) // bytes of buffers for cold runs
+#define RANDOM_OFFSETS 4096               // a power of two
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MAX_RECORD_SIZE 4096
+
+static const size_t record_sizes[] = {16, 256, MAX_RECORD_SIZE};
+
+static long iterations = DEFAULT_ITERATIONS;
+static FILE *csv;
+static char *record; // the bytes of every record
+static uint64_t random_offsets[RANDOM_OFFSETS];
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *ring, const char *operation, const char *pattern,
+                   size_t record_size, long ops, uint64_t elapsed_ns) {
+  fprintf(csv, "%d,%s,%s,%s,%zu,%ld,%.2f\n",
+          AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, ring, operation, pattern,
+          record_size, ops, (double)elapsed_ns / ops);
+}
+
+/*
+** Fill @param random_offsets with positions below @param size
+*/
+static void shuffle_offsets(uint64_t size) {
+  uint64_t x = 88172645463325252ull;
+
+  for (size_t i = 0; i < RANDOM_OFFSETS; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    random_offsets[i] = x % size;
+  }
+}
+
+/*
+** Keep @param value alive so the compiler cannot drop the work computing it
+*/
+static void consume(const void *value) {
+  __asm__ volatile("" : : "r"(value) : "memory");
+}
+
+static void fill_circular(struct aesd_circular_buffer *buffer,
+                          size_t record_size) {
+  struct aesd_buffer_entry entry = {.buffptr = record, .size = record_size};
+
+  aesd_circular_buffer_init(buffer);
+  for (int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i) {
+    aesd_circular_buffer_add_entry(buffer, &entry);
+  }
+}
+
+static void bench_circular(size_t record_size) {
+  struct aesd_circular_buffer buffer;
+  struct aesd_buffer_entry entry = {.buffptr = record, .size = record_size};
+  size_t const ring_size =
+      AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * record_size;
+  size_t offset;
+
+  aesd_circular_buffer_init(&buffer);
+  uint64_t start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    aesd_circular_buffer_add_entry(&buffer, &entry);
+  }
+  report("circular", "add_entry", "hot", record_size, iterations,
+         now_ns() - start);
+
+  fill_circular(&buffer, record_size);
+  start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    consume(aesd_circular_buffer_find_entry_offset_for_fpos(
+        &buffer, (size_t)i % ring_size, &offset));
+  }
+  report("circular", "find_fpos", "sequential", record_size, iterations,
+         now_ns() - start);
+
+  shuffle_offsets(ring_size);
+  start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    consume(aesd_circular_buffer_find_entry_offset_for_fpos(
+        &buffer, random_offsets[i & (RANDOM_OFFSETS - 1)], &offset));
+  }
+  report("circular", "find_fpos", "random", record_size, iterations,
+         now_ns() - start);
+
+  char *out = malloc(ring_size);
+  if (out == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  long const copies = iterations / AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1;
+  start = now_ns();
+  for (long i = 0; i < copies; ++i) {
+    aesd_circular_buffer_copy_range(
+        &buffer, aesd_circular_buffer_first_offset(&buffer), out, ring_size);
+    consume(out);
+  }
+  report("circular", "copy_range", "whole", record_size,
+         copies * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, now_ns() - start);
+  free(out);
+}
+
+static void bench_circular_cold(void) {
+  size_t const count =
+      COLD_FOOTPRINT / sizeof(struct aesd_circular_buffer) + 1;
+  struct aesd_circular_buffer *buffers =
+      malloc(count * sizeof(struct aesd_circular_buffer));
+  struct aesd_buffer_entry entry = {.buffptr = record, .size = 64};
+  size_t const ring_size = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 64;
+  size_t offset;
+
+  if (buffers == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    fill_circular(&buffers[i], 64);
+  }
+
+  uint64_t start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    aesd_circular_buffer_add_entry(&buffers[(size_t)i % count], &entry);
+  }
+  report("circular", "add_entry", "cold", 64, iterations, now_ns() - start);
+
+  shuffle_offsets(ring_size);
+  start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    consume(aesd_circular_buffer_find_entry_offset_for_fpos(
+        &buffers[(size_t)i % count], random_offsets[i & (RANDOM_OFFSETS - 1)],
+        &offset));
+  }
+  report("circular", "find_fpos", "cold", 64, iterations, now_ns() - start);
+
+  free(buffers);
+}
+
+static void bench_arena(size_t record_size) {
+  struct aesd_arena_buffer buffer;
+  size_t data_size = 1;
+  size_t offset;
+
+  // room for every descriptor
+  while (data_size < AESDCHAR_ARENA_MAX_ENTRIES * record_size) {
+    data_size *= 2;
+  }
+  char *data = malloc(data_size);
+  char *out = malloc(data_size);
+  if (data == NULL || out == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  aesd_arena_buffer_init(&buffer, data, data_size);
+  uint64_t start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    aesd_arena_buffer_add_entry(&buffer, record, record_size);
+  }
+  report("arena", "add_entry", "hot", record_size, iterations,
+         now_ns() - start);
+
+  uint64_t const size = buffer.head - buffer.tail;
+  start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    consume(aesd_arena_buffer_find_entry_for_offset(
+        &buffer, buffer.tail + (uint64_t)i % size, &offset));
+  }
+  report("arena", "find_offset", "sequential", record_size, iterations,
+         now_ns() - start);
+
+  shuffle_offsets(size);
+  start = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    consume(aesd_arena_buffer_find_entry_for_offset(
+        &buffer, buffer.tail + random_offsets[i & (RANDOM_OFFSETS - 1)],
+        &offset));
+  }
+  report("arena", "find_offset", "random", record_size, iterations,
+         now_ns() - start);
+
+  long const copies = iterations / AESDCHAR_ARENA_MAX_ENTRIES + 1;
+  start = now_ns();
+  for (long i = 0; i < copies; ++i) {
+    aesd_arena_buffer_copy(&buffer, buffer.tail, out, size);
+    consume(out);
+  }
+  report("arena", "copy", "whole", record_size,
+         copies * (long)aesd_arena_buffer_count(&buffer), now_ns() - start);
+
+  free(out);
+  free(data);
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:o:")) != -1) {
+    switch (c) {
+    case 'n':
+      iterations = atol(optarg);
+      break;
+    case 'o':
+      path = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n iterations] [-o file.csv]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (iterations <= 0) {
+    fprintf(stderr, "iterations must be positive\n");
+    return 1;
+  }
+
+  // rows are appended to the file, the header only starts an empty one
+  csv = path ? fopen(path, "a") : stdout;
+  if (csv == NULL) {
+    perror(path);
+    return 1;
+  }
+  if (csv == stdout || (fseek(csv, 0, SEEK_END) == 0 && ftell(csv) == 0)) {
+    fprintf(csv, "capacity,ring,operation,pattern,record_size,ops,ns_per_op\n");
+  }
+
+  record = malloc(MAX_RECORD_SIZE);
+  if (record == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  memset(record, 'a', MAX_RECORD_SIZE);
+
+  for (size_t i = 0; i < ARRAY_SIZE(record_sizes); ++i) {
+    bench_circular(record_sizes[i]);
+    bench_arena(record_sizes[i]);
+  }
+  bench_circular_cold();
+
+  free(record);
+  if (csv != stdout) {
+    fclose(csv);
+  }
+  return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file aesdchar-snapshot.c
+ * @brief Save and restore the records of the aesdchar device
+ *
+ * "save" writes the snapshot returned by AESDCHAR_IOCEXPORT to a file and
+ * "restore" hands it back through AESDCHAR_IOCIMPORT, so the records survive
+ * a reload of the module. Used by aesdchar_unload and aesdchar_load.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../aesd_ioctl.h"
+
+#define DEFAULT_DEVICE "/dev/aesdchar"
+
+/*
+** Write @param size bytes of @param buf to @param path through a temporary
+** file, so an interrupted save never leaves a truncated snapshot behind
+** @return 0 on success, -1 on error
+*/
+static int write_file(const char *path, const char *buf, size_t size) {
+  char tmp_path[4096];
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+      (int)sizeof(tmp_path)) {
+    fprintf(stderr, "%s: path too long\n", path);
+    return -1;
+  }
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "open %s: %s\n", tmp_path, strerror(errno));
+    return -1;
+  }
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t ret = write(fd, buf + done, size - done);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "write %s: %s\n", tmp_path, strerror(errno));
+      goto fail;
+    }
+    done += ret;
+  }
+
+  if (fsync(fd) != 0) {
+    fprintf(stderr, "fsync %s: %s\n", tmp_path, strerror(errno));
+    goto fail;
+  }
+  close(fd);
+
+  if (rename(tmp_path, path) != 0) {
+    fprintf(stderr, "rename %s: %s\n", path, strerror(errno));
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+
+fail:
+  close(fd);
+  unlink(tmp_path);
+  return -1;
+}
+
+/*
+** Read the whole file @param path
+** @return a malloc'd buffer holding its contents, and its size in
+** @param size, or NULL on error
+*/
+static char *read_file(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "stat %s: %s\n", path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  char *buf = malloc(st.st_size ? st.st_size : 1);
+  if (buf == NULL) {
+    perror("malloc");
+    close(fd);
+    return NULL;
+  }
+
+  size_t done = 0;
+  while (done < (size_t)st.st_size) {
+    ssize_t ret = read(fd, buf + done, st.st_size - done);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      fprintf(stderr, "read %s: %s\n", path,
+              ret < 0 ? strerror(errno) : "unexpected end of file");
+      free(buf);
+      close(fd);
+      return NULL;
+    }
+    done += ret;
+  }
+
+  close(fd);
+  *size = done;
+  return buf;
+}
+
+static int save(const char *device, const char *path) {
+  int fd = open(device, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "open %s: %s\n", device, strerror(errno));
+    return 1;
+  }
+
+  // ask for the size first, and again if records arrive in between
+  struct aesd_snapshot snapshot = {0};
+  char *buf = NULL;
+  while (ioctl(fd, AESDCHAR_IOCEXPORT, &snapshot) != 0) {
+    if (errno != ERANGE) {
+      fprintf(stderr, "AESDCHAR_IOCEXPORT: %s\n", strerror(errno));
+      free(buf);
+      close(fd);
+      return 1;
+    }
+
+    free(buf);
+    buf = malloc(snapshot.size);
+    if (buf == NULL) {
+      perror("malloc");
+      close(fd);
+      return 1;
+    }
+    snapshot.buf = (uintptr_t)buf;
+  }
+  close(fd);
+
+  int rc = write_file(path, buf, snapshot.size) == 0 ? 0 : 1;
+  if (rc == 0) {
+    const struct aesd_snapshot_header *header =
+        (const struct aesd_snapshot_header *)buf;
+    printf("saved %u records, %llu bytes, to %s\n", header->count,
+           (unsigned long long)snapshot.size, path);
+  }
+  free(buf);
+  return rc;
+}
+
+static int restore(const char *device, const char *path) {
+  size_t size;
+  char *buf = read_file(path, &size);
+  if (buf == NULL) {
+    return 1;
+  }
+
+  int fd = open(device, O_WRONLY);
+  if (fd < 0) {
+    fprintf(stderr, "open %s: %s\n", device, strerror(errno));
+    free(buf);
+    return 1;
+  }
+
+  struct aesd_snapshot snapshot = {.buf = (uintptr_t)buf, .size = size};
+  int rc = 0;
+  if (ioctl(fd, AESDCHAR_IOCIMPORT, &snapshot) != 0) {
+    fprintf(stderr, "AESDCHAR_IOCIMPORT: %s\n", strerror(errno));
+    rc = 1;
+  } else {
+    printf("restored %zu bytes from %s\n", size, path);
+  }
+
+  close(fd);
+  free(buf);
+  return rc;
+}
+
+int main(int argc, char **argv) {
+  const char *device = DEFAULT_DEVICE;
+
+  int c;
+  while ((c = getopt(argc, argv, "d:")) != -1) {
+    switch (c) {
+    case 'd':
+      device = optarg;
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (argc - optind == 2 && strcmp(argv[optind], "save") == 0) {
+    return save(device, argv[optind + 1]);
+  }
+  if (argc - optind == 2 && strcmp(argv[optind], "restore") == 0) {
+    return restore(device, argv[optind + 1]);
+  }
+
+usage:
+  fprintf(stderr, "usage: %s [-d device] save|restore file\n", argv[0]);
+  return 1;
+}
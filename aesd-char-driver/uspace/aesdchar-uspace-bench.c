@@ -0,0 +1,278 @@
+/**
+ * @file aesdchar-uspace-bench.c
+ * @brief Microbenchmarks of the aesdchar file operations built in user space
+ *
+ * Runs the read, write, partial write and seek paths of main.c against the
+ * kshim.h stand-ins for the kernel API, so driver changes can be compared on
+ * any machine without loading the module. Reports the throughput and latency
+ * percentiles of each pattern, then the write throughput of several threads.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kshim-driver.h"
+
+#define DEFAULT_ITERATIONS 200000
+#define DEFAULT_RECORD_SIZE 64
+#define DEFAULT_CHUNK_SIZE 8
+#define DEFAULT_MAX_THREADS 8
+
+static int iterations = DEFAULT_ITERATIONS;
+static size_t record_size = DEFAULT_RECORD_SIZE;
+static size_t chunk_size = DEFAULT_CHUNK_SIZE;
+static int max_threads = DEFAULT_MAX_THREADS;
+
+static char *record;
+static uint64_t *latencies;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+** Print the throughput of @param ops operations moving @param bytes bytes in
+** @param elapsed_ns, and the percentiles of the first @param ops latencies
+*/
+static void report(const char *name, size_t ops, size_t bytes,
+                   uint64_t elapsed_ns) {
+  qsort(latencies, ops, sizeof(uint64_t), compare_u64);
+  printf("%-14s ops=%-8zu %8.1f ns/op %9.2f MB/s  p50=%" PRIu64
+         " p99=%" PRIu64 " max=%" PRIu64 " ns\n",
+         name, ops, (double)elapsed_ns / ops,
+         bytes ? (double)bytes / elapsed_ns * 1e3 : 0.0, latencies[ops / 2],
+         latencies[ops * 99 / 100], latencies[ops - 1]);
+}
+
+/*
+** Reload the driver so each benchmark starts from an empty ring
+*/
+static void reset_device(struct file *filp) {
+  static bool loaded;
+
+  if (loaded) {
+    kshim_release(filp);
+    aesd_cleanup_module();
+  }
+  if (aesd_init_module() != 0 || kshim_open(filp) != 0) {
+    fprintf(stderr, "could not initialize the driver\n");
+    exit(1);
+  }
+  loaded = true;
+}
+
+static void bench_write(struct file *filp) {
+  reset_device(filp);
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t t = now_ns();
+    if (kshim_write(filp, record, record_size) != (ssize_t)record_size) {
+      fprintf(stderr, "write failed\n");
+      exit(1);
+    }
+    latencies[i] = now_ns() - t;
+  }
+  report("write", iterations, iterations * record_size, now_ns() - start);
+}
+
+/*
+** Records built out of chunk_size byte writes, each of them timed
+*/
+static void bench_partial_write(struct file *filp) {
+  reset_device(filp);
+
+  size_t done = 0;
+  size_t bytes = 0;
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; ++i) {
+    size_t chunk = min(chunk_size, record_size - done);
+    uint64_t t = now_ns();
+    if (kshim_write(filp, record + done, chunk) != (ssize_t)chunk) {
+      fprintf(stderr, "partial write failed\n");
+      exit(1);
+    }
+    latencies[i] = now_ns() - t;
+    bytes += chunk;
+    done = (done + chunk) % record_size;
+  }
+  report("partial-write", iterations, bytes, now_ns() - start);
+}
+
+static void bench_read(struct file *filp) {
+  reset_device(filp);
+  for (int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i) {
+    kshim_write(filp, record, record_size);
+  }
+
+  size_t ring_size = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * record_size;
+  char *buf = malloc(ring_size);
+  if (buf == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t t = now_ns();
+    aesd_llseek(filp, 0, SEEK_DATA);
+    if (kshim_read(filp, buf, ring_size) != (ssize_t)ring_size) {
+      fprintf(stderr, "read failed\n");
+      exit(1);
+    }
+    latencies[i] = now_ns() - t;
+  }
+  report("read-ring", iterations, iterations * ring_size, now_ns() - start);
+  free(buf);
+}
+
+static void bench_seek(struct file *filp) {
+  reset_device(filp);
+  for (int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; ++i) {
+    kshim_write(filp, record, record_size);
+  }
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; ++i) {
+    struct aesd_seekto seekto = {
+        .write_cmd = i % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+        .write_cmd_offset = i % record_size};
+    uint64_t t = now_ns();
+    if (aesd_ioctl(filp, AESDCHAR_IOCSEEKTO, (unsigned long)&seekto) < 0) {
+      fprintf(stderr, "AESDCHAR_IOCSEEKTO failed\n");
+      exit(1);
+    }
+    latencies[i] = now_ns() - t;
+  }
+  report("seekto", iterations, 0, now_ns() - start);
+
+  start = now_ns();
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t t = now_ns();
+    aesd_llseek(filp, i % 2 ? 0 : -1, i % 2 ? SEEK_DATA : SEEK_END);
+    latencies[i] = now_ns() - t;
+  }
+  report("llseek", iterations, 0, now_ns() - start);
+}
+
+struct writer {
+  pthread_t thread;
+  int records;
+};
+
+static void *writer_thread(void *arg) {
+  struct writer *writer = (struct writer *)arg;
+  struct file filp;
+
+  kshim_open(&filp);
+  for (int i = 0; i < writer->records; ++i) {
+    kshim_write(&filp, record, record_size);
+  }
+  kshim_release(&filp);
+  return NULL;
+}
+
+static void bench_concurrent_write(struct file *filp) {
+  struct writer *writers = calloc(max_threads, sizeof(struct writer));
+  if (writers == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    reset_device(filp);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; ++i) {
+      writers[i].records = iterations / threads;
+      pthread_create(&writers[i].thread, NULL, writer_thread, &writers[i]);
+    }
+    for (int i = 0; i < threads; ++i) {
+      pthread_join(writers[i].thread, NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    size_t records = (size_t)(iterations / threads) * threads;
+    printf("write x%-7d records=%-8zu %8.1f ns/record %9.2f MB/s\n", threads,
+           records, (double)elapsed / records,
+           (double)records * record_size / elapsed * 1e3);
+  }
+  free(writers);
+}
+
+int main(int argc, char **argv) {
+  bool stats = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:c:t:v")) != -1) {
+    switch (c) {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 's':
+      record_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      chunk_size = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'v':
+      stats = true;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-n iterations] [-s record_size] [-c chunk_size] "
+              "[-t max_threads] [-v]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (iterations <= 0 || record_size == 0 || chunk_size == 0 ||
+      max_threads <= 0) {
+    fprintf(stderr, "all values must be positive\n");
+    return 1;
+  }
+
+  record = malloc(record_size);
+  latencies = calloc(iterations, sizeof(uint64_t));
+  if (record == NULL || latencies == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  memset(record, 'a', record_size - 1);
+  record[record_size - 1] = '\n';
+
+  struct file filp;
+  printf("record_size=%zu chunk_size=%zu iterations=%d\n", record_size,
+         chunk_size, iterations);
+  bench_write(&filp);
+  bench_partial_write(&filp);
+  bench_read(&filp);
+  bench_seek(&filp);
+  bench_concurrent_write(&filp);
+  if (stats) {
+    printf("%s", kshim_debugfs_read());
+  }
+
+  kshim_release(&filp);
+  aesd_cleanup_module();
+  free(latencies);
+  free(record);
+  return 0;
+}
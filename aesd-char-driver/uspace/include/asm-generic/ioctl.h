@@ -0,0 +1,2 @@
+// the ioctl number macros are the same in user space
+#include_next <asm-generic/ioctl.h>
@@ -0,0 +1,644 @@
+/*
+ * kshim.h
+ *
+ * Just enough of the kernel API for main.c and aesd-circular-buffer.c to
+ * build and run as a regular process: allocations map to malloc, mutexes and
+ * wait queues to pthreads, user copies and iov_iter to memcpy. Every
+ * include/linux/ header in this directory includes this file.
+ *
+ * Only what the driver uses is provided, with the semantics it relies on. It
+ * is meant for benchmarks and tests of the driver logic, not for timing the
+ * kernel itself: copy_to_user never faults and mutexes never sleep in the
+ * kernel sense.
+ */
+
+#ifndef AESD_KSHIM_H
+#define AESD_KSHIM_H
+
+#include <errno.h>
+#include <fcntl.h> // O_NONBLOCK
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+** Annotations, module boilerplate and printk
+*/
+#define __user
+#define __percpu
+#define THIS_MODULE NULL
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_PARM_DESC(name, desc)
+#define module_param(name, type, perm)
+#define module_init(fn)
+#define module_exit(fn)
+
+#define KERN_DEBUG ""
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 6, 0)
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+
+/*
+** Helpers from linux/kernel.h and linux/compiler.h
+*/
+#define container_of(ptr, type, member)                                        \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) ((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define max_t(type, a, b) ((type)(a) > (type)(b) ? (type)(a) : (type)(b))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(cond) _Static_assert(!(cond), #cond)
+#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile typeof(x) *)&(x) = (val))
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+static inline u64 div_u64_rem(u64 dividend, u32 divisor, u32 *remainder) {
+  *remainder = dividend % divisor;
+  return dividend / divisor;
+}
+typedef unsigned int gfp_t;
+typedef unsigned int __poll_t;
+
+#define PAGE_SIZE 4096UL
+#define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define MAX_RW_COUNT (INT32_MAX & ~(PAGE_SIZE - 1))
+#define MAX_LFS_FILESIZE ((loff_t)INT64_MAX)
+#define U64_MAX UINT64_MAX
+
+#define ERESTARTSYS 512
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+
+/*
+** Memory allocation
+*/
+#define GFP_KERNEL 0u
+
+static inline void *kmalloc(size_t size, gfp_t flags) {
+  (void)flags;
+  return malloc(size ? size : 1);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags) {
+  (void)flags;
+  return calloc(1, size ? size : 1);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags) {
+  (void)flags;
+  return calloc(n ? n : 1, size ? size : 1);
+}
+
+static inline void *krealloc(const void *ptr, size_t size, gfp_t flags) {
+  (void)flags;
+  return realloc((void *)ptr, size);
+}
+
+static inline void kfree(const void *ptr) { free((void *)ptr); }
+
+#define kvmalloc kmalloc
+#define kvfree kfree
+#define kvcalloc kcalloc
+#define kvmalloc_array(n, size, flags) kmalloc((n) * (size), flags)
+#define vfree kfree
+
+static inline void *vmalloc_user(unsigned long size) {
+  return calloc(1, size);
+}
+
+struct kmem_cache {
+  size_t size;
+};
+
+static inline struct kmem_cache *
+kmem_cache_create_usercopy(const char *name, unsigned int size,
+                           unsigned int align, unsigned int flags,
+                           unsigned int useroffset, unsigned int usersize,
+                           void (*ctor)(void *)) {
+  struct kmem_cache *cache = (struct kmem_cache *)malloc(sizeof(*cache));
+  (void)name, (void)align, (void)flags, (void)useroffset, (void)usersize;
+  (void)ctor;
+  if (cache) {
+    cache->size = size;
+  }
+  return cache;
+}
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t flags) {
+  return kmalloc(cache->size, flags);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cache, void *ptr) {
+  (void)cache;
+  free(ptr);
+}
+
+static inline void kmem_cache_free_bulk(struct kmem_cache *cache, size_t n,
+                                        void **ptrs) {
+  for (size_t i = 0; i < n; ++i) {
+    kmem_cache_free(cache, ptrs[i]);
+  }
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *cache) {
+  free(cache);
+}
+
+/*
+** User copies, where user space is the calling process
+*/
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+#define get_user(x, ptr) ((x) = *(ptr), 0)
+#define put_user(x, ptr) (*(ptr) = (x), 0)
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+                                         unsigned long n) {
+  memcpy(to, from, n);
+  return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from,
+                                           unsigned long n) {
+  memcpy(to, from, n);
+  return 0;
+}
+
+/*
+** Locking, atomics, time
+*/
+struct mutex {
+  pthread_mutex_t lock;
+};
+
+static inline void mutex_init(struct mutex *m) {
+  pthread_mutex_init(&m->lock, NULL);
+}
+static inline void mutex_destroy(struct mutex *m) {
+  pthread_mutex_destroy(&m->lock);
+}
+static inline void mutex_lock(struct mutex *m) { pthread_mutex_lock(&m->lock); }
+static inline int mutex_lock_interruptible(struct mutex *m) {
+  return pthread_mutex_lock(&m->lock);
+}
+static inline int mutex_trylock(struct mutex *m) {
+  return pthread_mutex_trylock(&m->lock) == 0;
+}
+static inline void mutex_unlock(struct mutex *m) {
+  pthread_mutex_unlock(&m->lock);
+}
+
+typedef struct {
+  int counter;
+} atomic_t;
+
+static inline void atomic_inc(atomic_t *v) {
+  __atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED);
+}
+static inline void atomic_sub(int i, atomic_t *v) {
+  __atomic_fetch_sub(&v->counter, i, __ATOMIC_RELAXED);
+}
+static inline int atomic_read(const atomic_t *v) {
+  return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+#define smp_mb__after_atomic() smp_mb()
+
+typedef struct {
+  int64_t counter;
+} atomic64_t;
+
+static inline void atomic64_inc(atomic64_t *v) {
+  __atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED);
+}
+static inline int64_t atomic64_read(const atomic64_t *v) {
+  return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+  int refs;
+} refcount_t;
+
+static inline void refcount_set(refcount_t *r, int n) {
+  __atomic_store_n(&r->refs, n, __ATOMIC_RELAXED);
+}
+static inline bool refcount_dec_and_test(refcount_t *r) {
+  return __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static inline uint64_t ktime_get_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+** Wait queues and poll
+*/
+typedef struct wait_queue_head {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq) {
+  pthread_mutex_init(&wq->lock, NULL);
+  pthread_cond_init(&wq->cond, NULL);
+}
+
+static inline void wake_up_interruptible(wait_queue_head_t *wq) {
+  pthread_mutex_lock(&wq->lock);
+  pthread_cond_broadcast(&wq->cond);
+  pthread_mutex_unlock(&wq->lock);
+}
+
+#define wait_event_interruptible(wq, condition)                                \
+  ({                                                                           \
+    pthread_mutex_lock(&(wq).lock);                                            \
+    while (!(condition)) {                                                     \
+      pthread_cond_wait(&(wq).cond, &(wq).lock);                               \
+    }                                                                          \
+    pthread_mutex_unlock(&(wq).lock);                                          \
+    0;                                                                         \
+  })
+
+/*
+** Completions, where waits are never interrupted
+*/
+struct completion {
+  bool done;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+static inline void init_completion(struct completion *x) {
+  x->done = false;
+  pthread_mutex_init(&x->lock, NULL);
+  pthread_cond_init(&x->cond, NULL);
+}
+
+static inline void complete(struct completion *x) {
+  pthread_mutex_lock(&x->lock);
+  x->done = true;
+  pthread_cond_signal(&x->cond);
+  pthread_mutex_unlock(&x->lock);
+}
+
+static inline int wait_for_completion_killable(struct completion *x) {
+  pthread_mutex_lock(&x->lock);
+  while (!x->done) {
+    pthread_cond_wait(&x->cond, &x->lock);
+  }
+  pthread_mutex_unlock(&x->lock);
+  return 0;
+}
+
+#define EPOLLIN 0x001u
+#define EPOLLOUT 0x004u
+#define EPOLLRDNORM 0x040u
+#define EPOLLWRNORM 0x100u
+
+typedef struct poll_table_struct {
+  int unused;
+} poll_table;
+
+struct file;
+static inline void poll_wait(struct file *filp, wait_queue_head_t *wq,
+                             poll_table *wait) {
+  (void)filp, (void)wq, (void)wait;
+}
+
+/*
+** Lock-less lists and per-CPU data, with SHIM_NR_CPUS CPUs picked by thread
+*/
+struct llist_node {
+  struct llist_node *next;
+};
+
+struct llist_head {
+  struct llist_node *first;
+};
+
+static inline bool llist_add(struct llist_node *node, struct llist_head *head) {
+  struct llist_node *first = __atomic_load_n(&head->first, __ATOMIC_RELAXED);
+  do {
+    node->next = first;
+  } while (!__atomic_compare_exchange_n(&head->first, &first, node, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return first == NULL;
+}
+
+static inline bool llist_empty(const struct llist_head *head) {
+  return __atomic_load_n(&head->first, __ATOMIC_RELAXED) == NULL;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head) {
+  return __atomic_exchange_n(&head->first, NULL, __ATOMIC_ACQUIRE);
+}
+
+static inline struct llist_node *llist_reverse_order(struct llist_node *head) {
+  struct llist_node *reversed = NULL;
+  while (head) {
+    struct llist_node *node = head;
+    head = head->next;
+    node->next = reversed;
+    reversed = node;
+  }
+  return reversed;
+}
+
+#define llist_for_each_entry_safe(pos, n, node, member)                        \
+  for (pos = (node) ? container_of((node), typeof(*pos), member) : NULL;       \
+       pos && (n = pos->member.next                                            \
+                       ? container_of(pos->member.next, typeof(*pos), member)  \
+                       : NULL,                                                 \
+              true);                                                           \
+       pos = n)
+
+#define SHIM_NR_CPUS 8
+
+// the CPU of a thread is picked from its id once
+static inline int kshim_cpu(void) {
+  static __thread int cpu = -1;
+
+  if (cpu == -1) {
+    cpu = syscall(SYS_gettid) % SHIM_NR_CPUS;
+  }
+  return cpu;
+}
+#define alloc_percpu(type) ((type *)calloc(SHIM_NR_CPUS, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) (&(ptr)[cpu])
+#define raw_cpu_ptr(ptr) (&(ptr)[kshim_cpu()])
+#define for_each_possible_cpu(cpu)                                             \
+  for ((cpu) = 0; (cpu) < SHIM_NR_CPUS; ++(cpu))
+
+/*
+** Files, character devices and iov_iter
+*/
+struct module;
+struct kiocb;
+struct iov_iter;
+struct vm_area_struct;
+
+struct cdev {
+  const struct file_operations *ops;
+  struct module *owner;
+};
+
+struct inode {
+  struct cdev *i_cdev;
+};
+
+typedef unsigned int fmode_t;
+#define FMODE_READ ((fmode_t)0x1)
+#define FMODE_WRITE ((fmode_t)0x2)
+
+struct file {
+  void *private_data;
+  loff_t f_pos;
+  unsigned int f_flags;
+  fmode_t f_mode;
+};
+
+struct file_operations {
+  struct module *owner;
+  loff_t (*llseek)(struct file *, loff_t, int);
+  ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+  ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+  ssize_t (*splice_read)(struct file *, loff_t *, void *, size_t,
+                         unsigned int);
+  ssize_t (*splice_write)(void *, struct file *, loff_t *, size_t,
+                          unsigned int);
+  long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+  int (*open)(struct inode *, struct file *);
+  int (*release)(struct inode *, struct file *);
+  int (*mmap)(struct file *, struct vm_area_struct *);
+  __poll_t (*poll)(struct file *, poll_table *);
+};
+
+#define MKDEV(major, minor) (((major) << 20) | (minor))
+#define MAJOR(dev) ((unsigned int)(dev) >> 20)
+
+static inline void cdev_init(struct cdev *cdev,
+                             const struct file_operations *fops) {
+  cdev->ops = fops;
+}
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count) {
+  (void)cdev, (void)dev, (void)count;
+  return 0;
+}
+static inline void cdev_del(struct cdev *cdev) { (void)cdev; }
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int baseminor,
+                                      unsigned int count, const char *name) {
+  (void)count, (void)name;
+  *dev = MKDEV(240, baseminor);
+  return 0;
+}
+static inline void unregister_chrdev_region(dev_t dev, unsigned int count) {
+  (void)dev, (void)count;
+}
+
+#define IOCB_NOWAIT 1
+
+struct kiocb {
+  struct file *ki_filp;
+  loff_t ki_pos;
+  int ki_flags;
+};
+
+struct iov_iter {
+  const struct iovec *iov;
+  size_t iov_offset;
+  size_t count;
+};
+
+static inline void iov_iter_init(struct iov_iter *iter,
+                                 const struct iovec *iov,
+                                 unsigned long nr_segs) {
+  iter->iov = iov;
+  iter->iov_offset = 0;
+  iter->count = 0;
+  for (unsigned long i = 0; i < nr_segs; ++i) {
+    iter->count += iov[i].iov_len;
+  }
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *iter) {
+  return iter->count;
+}
+
+static inline size_t kshim_iter_copy(void *buf, size_t bytes,
+                                     struct iov_iter *iter, bool to_iter) {
+  size_t done = 0;
+  while (done < bytes && iter->count) {
+    size_t seg = iter->iov->iov_len - iter->iov_offset;
+    size_t n = min(bytes - done, seg);
+    char *user = (char *)iter->iov->iov_base + iter->iov_offset;
+
+    if (to_iter) {
+      memcpy(user, (char *)buf + done, n);
+    } else {
+      memcpy((char *)buf + done, user, n);
+    }
+    done += n;
+    iter->count -= n;
+    iter->iov_offset += n;
+    if (iter->iov_offset == iter->iov->iov_len) {
+      ++iter->iov;
+      iter->iov_offset = 0;
+    }
+  }
+  return done;
+}
+
+static inline size_t copy_to_iter(const void *buf, size_t bytes,
+                                  struct iov_iter *iter) {
+  return kshim_iter_copy((void *)buf, bytes, iter, true);
+}
+
+static inline bool copy_from_iter_full(void *buf, size_t bytes,
+                                       struct iov_iter *iter) {
+  return kshim_iter_copy(buf, bytes, iter, false) == bytes;
+}
+
+// splice is not available, callers use read and write
+static inline ssize_t copy_splice_read(struct file *in, loff_t *ppos,
+                                       void *pipe, size_t len,
+                                       unsigned int flags) {
+  (void)in, (void)ppos, (void)pipe, (void)len, (void)flags;
+  return -EINVAL;
+}
+static inline ssize_t iter_file_splice_write(void *pipe, struct file *out,
+                                             loff_t *ppos, size_t len,
+                                             unsigned int flags) {
+  (void)pipe, (void)out, (void)ppos, (void)len, (void)flags;
+  return -EINVAL;
+}
+
+/*
+** Read and write the way vfs_read and vfs_write do for a single buffer,
+** keeping the position unchanged when the call fails
+*/
+#define KSHIM_RW(fn, filp, buf, count, ppos)                                   \
+  ({                                                                           \
+    struct iovec _iov = {.iov_base = (void *)(buf), .iov_len = (count)};       \
+    struct iov_iter _iter;                                                     \
+    struct kiocb _kiocb = {.ki_filp = (filp), .ki_pos = *(ppos)};              \
+    iov_iter_init(&_iter, &_iov, 1);                                           \
+    ssize_t _ret = fn(&_kiocb, &_iter);                                        \
+    if (_ret >= 0) {                                                           \
+      *(ppos) = _kiocb.ki_pos;                                                 \
+    }                                                                          \
+    _ret;                                                                      \
+  })
+
+/*
+** mmap
+*/
+#define VM_WRITE 0x2ul
+#define VM_MAYWRITE 0x20ul
+
+struct vm_area_struct {
+  unsigned long vm_flags;
+  unsigned long vm_pgoff;
+};
+
+static inline void vm_flags_clear(struct vm_area_struct *vma,
+                                  unsigned long flags) {
+  vma->vm_flags &= ~flags;
+}
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+                                      unsigned long pgoff) {
+  (void)vma, (void)addr, (void)pgoff;
+  return 0;
+}
+
+/*
+** debugfs keeps the last file created, read with kshim_debugfs_read
+*/
+struct dentry {
+  int unused;
+};
+
+struct seq_file {
+  void *private;
+  char buf[4096];
+  size_t len;
+};
+
+static inline void seq_printf(struct seq_file *s, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(s->buf + s->len, sizeof(s->buf) - s->len, fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    s->len = min(s->len + n, sizeof(s->buf) - 1);
+  }
+}
+
+struct kshim_show_fops {
+  int (*show)(struct seq_file *, void *);
+};
+
+#define DEFINE_SHOW_ATTRIBUTE(name)                                            \
+  static const struct kshim_show_fops name##_fops = {.show = name##_show}
+
+extern struct dentry kshim_debugfs_dir;
+extern const struct kshim_show_fops *kshim_debugfs_fops;
+extern void *kshim_debugfs_data;
+
+static inline struct dentry *debugfs_create_dir(const char *name,
+                                                struct dentry *parent) {
+  (void)name, (void)parent;
+  return &kshim_debugfs_dir;
+}
+
+static inline struct dentry *
+debugfs_create_file(const char *name, unsigned short mode,
+                    struct dentry *parent, void *data,
+                    const struct kshim_show_fops *fops) {
+  (void)name, (void)mode, (void)parent;
+  kshim_debugfs_data = data;
+  kshim_debugfs_fops = fops;
+  return &kshim_debugfs_dir;
+}
+
+static inline void debugfs_remove_recursive(struct dentry *dentry) {
+  (void)dentry;
+  kshim_debugfs_fops = NULL;
+}
+
+/*
+** Tracepoints compile to empty functions that still type check their
+** arguments
+*/
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define DECLARE_EVENT_CLASS(...)
+#define DEFINE_EVENT(class, name, proto, args)                                 \
+  static inline void trace_##name(proto) {}
+#define TRACE_EVENT(name, proto, args, ...)                                    \
+  static inline void trace_##name(proto) {}
+
+#endif /* AESD_KSHIM_H */
@@ -0,0 +1 @@
+// tracepoints are empty functions, see kshim.h
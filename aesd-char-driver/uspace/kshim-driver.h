@@ -0,0 +1,50 @@
+/*
+ * kshim-driver.h
+ *
+ * Entry points of the user space build of the aesdchar driver: the file
+ * operations of main.c called the way the VFS calls them, on a device
+ * initialized with aesd_init_module.
+ */
+
+#ifndef AESD_KSHIM_DRIVER_H
+#define AESD_KSHIM_DRIVER_H
+
+#include "kshim.h"
+
+#include "../aesdchar.h"
+
+extern struct aesd_dev aesd_device;
+
+/*
+** Open @param filp on the device for reading and writing, as open(2) with
+** O_RDWR does
+*/
+static inline int kshim_open(struct file *filp) {
+  static struct inode inode = {.i_cdev = &aesd_device.cdev};
+
+  memset(filp, 0, sizeof(*filp));
+  filp->f_mode = FMODE_READ | FMODE_WRITE;
+  return aesd_open(&inode, filp);
+}
+
+static inline int kshim_release(struct file *filp) {
+  static struct inode inode = {.i_cdev = &aesd_device.cdev};
+
+  return aesd_release(&inode, filp);
+}
+
+static inline ssize_t kshim_read(struct file *filp, void *buf, size_t count) {
+  return KSHIM_RW(aesd_read_iter, filp, buf, count, &filp->f_pos);
+}
+
+static inline ssize_t kshim_write(struct file *filp, const void *buf,
+                                  size_t count) {
+  return KSHIM_RW(aesd_write_iter, filp, buf, count, &filp->f_pos);
+}
+
+/*
+** @return the contents of debugfs/aesdchar/stats
+*/
+const char *kshim_debugfs_read(void);
+
+#endif /* AESD_KSHIM_DRIVER_H */
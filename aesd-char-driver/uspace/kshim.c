@@ -0,0 +1,23 @@
+/**
+ * @file kshim.c
+ * @brief State behind the debugfs part of kshim.h
+ */
+
+#include "kshim.h"
+#include "kshim-driver.h"
+
+struct dentry kshim_debugfs_dir;
+const struct kshim_show_fops *kshim_debugfs_fops;
+void *kshim_debugfs_data;
+
+const char *kshim_debugfs_read(void) {
+  static struct seq_file s;
+
+  s.len = 0;
+  s.buf[0] = '\0';
+  s.private = kshim_debugfs_data;
+  if (kshim_debugfs_fops) {
+    kshim_debugfs_fops->show(&s, NULL);
+  }
+  return s.buf;
+}
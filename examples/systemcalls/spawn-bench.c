@@ -0,0 +1,120 @@
+/**
+ * @file spawn-bench.c
+ * @brief Launch latency of do_exec against fork() + execv() by parent RSS
+ *
+ * Grows the resident memory of the process step by step and, at each size,
+ * times launching /bin/true and waiting for it, with the fork() + execv()
+ * sequence do_exec used to run and with do_exec itself. fork() copies the
+ * page tables of the parent, so its latency grows with the RSS, posix_spawn
+ * does not.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "systemcalls.h"
+
+#define DEFAULT_LAUNCHES 200
+#define DEFAULT_MAX_RSS_MB 1024
+#define COMMAND "/bin/true"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool fork_exec(void) {
+  char *command[] = {COMMAND, NULL};
+  int status;
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    return false;
+  } else if (pid == 0) {
+    execv(command[0], command);
+    exit(-1);
+  }
+
+  return waitpid(pid, &status, 0) != -1 && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0;
+}
+
+static bool spawn_exec(void) { return do_exec(1, COMMAND); }
+
+static void bench(const char *name, bool (*launch)(void), size_t rss_mb,
+                  uint64_t *latencies, int launches) {
+  for (int i = 0; i < launches; ++i) {
+    uint64_t start = now_ns();
+    if (!launch()) {
+      fprintf(stderr, "%s: launching %s failed\n", name, COMMAND);
+      exit(1);
+    }
+    latencies[i] = now_ns() - start;
+  }
+
+  qsort(latencies, launches, sizeof(uint64_t), compare_u64);
+  printf("rss=%-5zu MB %-11s p50=%8.1f us p99=%8.1f us\n", rss_mb, name,
+         latencies[launches / 2] / 1e3, latencies[launches * 99 / 100] / 1e3);
+}
+
+int main(int argc, char **argv) {
+  int launches = DEFAULT_LAUNCHES;
+  size_t max_rss_mb = DEFAULT_MAX_RSS_MB;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:m:")) != -1) {
+    switch (c) {
+    case 'n':
+      launches = atoi(optarg);
+      break;
+    case 'm':
+      max_rss_mb = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n launches] [-m max_rss_mb]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (launches <= 0) {
+    fprintf(stderr, "launches must be positive\n");
+    return 1;
+  }
+
+  uint64_t *latencies = calloc(launches, sizeof(uint64_t));
+  if (latencies == NULL) {
+    perror("calloc");
+    return 1;
+  }
+
+  // keep every block, touched, so the RSS only grows
+  size_t rss_mb = 0;
+  for (size_t target = 0; target <= max_rss_mb;
+       target = target ? target * 4 : 64) {
+    for (; rss_mb < target; ++rss_mb) {
+      char *block = malloc(1024 * 1024);
+      if (block == NULL) {
+        perror("malloc");
+        return 1;
+      }
+      memset(block, 1, 1024 * 1024);
+    }
+
+    bench("fork+execv", fork_exec, rss_mb, latencies, launches);
+    bench("posix_spawn", spawn_exec, rss_mb, latencies, launches);
+  }
+
+  free(latencies);
+  return 0;
+}
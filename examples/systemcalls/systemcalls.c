@@ -1,10 +1,20 @@
+#define _GNU_SOURCE // pipe2, splice
 #include "systemcalls.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+extern char **environ;
+
 /*
 ** @param ret is the return value to be checked
 ** @return true if ret is -1, which normally indicates a fail
@@ -23,6 +33,53 @@ bool do_system(const char *cmd) {
   return !is_error(system(cmd));
 }
 
+/*
+** Wait for the child @param pid, retrying when a signal interrupts the wait
+** @return the waitpid() status of the child, -1 if it could not be waited for
+*/
+static int wait_status(pid_t pid) {
+  int status;
+
+  while (is_error(waitpid(pid, &status, 0))) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return status;
+}
+
+/*
+** @return true if @param status, from waitpid(), is an exit with status 0
+*/
+static bool status_success(int status) {
+  return !is_error(status) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+** Wait for the child @param pid
+** @return true if the child exited with status 0, false if it failed, was
+** killed by a signal or could not be waited for
+*/
+static bool wait_success(pid_t pid) { return status_success(wait_status(pid)); }
+
+/*
+** Run @param command, the full path to execute followed by its arguments and
+** NULL, and wait for it. posix_spawn starts the child without copying the
+** page tables of the caller, as vfork does, so the cost of a launch does not
+** grow with the memory of the caller, and reports a failed exec as an error.
+** @param actions are applied in the child before the exec, or NULL
+** @return true if the command ran and exited with status 0
+*/
+static bool spawn_and_wait(char *const command[],
+                           const posix_spawn_file_actions_t *actions) {
+  pid_t pid;
+
+  if (posix_spawn(&pid, command[0], actions, NULL, command, environ) != 0) {
+    return false;
+  }
+  return wait_success(pid);
+}
+
 /**
  * @param count -The numbers of variables passed to the function. The variables
  * are command to execute. followed by arguments to pass to the command Since
@@ -48,39 +105,371 @@ bool do_exec(int count, ...) {
     command[i] = va_arg(args, char *);
   }
   command[count] = NULL;
-  // this line is to avoid a compile warning before your implementation is
-  // complete and may be removed
-  command[count] = command[count];
+  va_end(args);
 
-  pid_t pid = fork();
-  int status;
+  return spawn_and_wait(command, NULL);
+}
+
+/**
+ * @param outputfile - The full path to the file to write with command output.
+ *   This file will be closed at completion of the function call.
+ * All other parameters, see do_exec above
+ */
+bool do_exec_redirect(const char *outputfile, int count, ...) {
+  va_list args;
+  va_start(args, count);
+  char *command[count + 1];
+  int i;
+  for (i = 0; i < count; i++) {
+    command[i] = va_arg(args, char *);
+  }
+  command[count] = NULL;
+  va_end(args);
 
-  if (is_error(pid)) {
+  // the child opens outputfile as its stdout, the parent never holds it
+  posix_spawn_file_actions_t actions;
+  if (posix_spawn_file_actions_init(&actions) != 0) {
     return false;
-  } else if (pid == 0) {
-    execv(command[0], command);
-    exit(-1);
   }
+  bool ret = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                              outputfile,
+                                              O_WRONLY | O_TRUNC | O_CREAT,
+                                              0644) == 0 &&
+             spawn_and_wait(command, &actions);
+  posix_spawn_file_actions_destroy(&actions);
 
-  if (is_error(waitpid(pid, &status, 0))) {
+  return ret;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t timeval_ns(struct timeval tv) {
+  return tv.tv_sec * 1000000000ull + tv.tv_usec * 1000ull;
+}
+
+/*
+** @return a file descriptor becoming readable when the child @param pid
+** exits, or -1 when the kernel lacks pidfd_open (before Linux 5.3)
+*/
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+/*
+** A command of a batch while it runs
+*/
+struct batch_child {
+  pid_t pid;
+  int pidfd;
+  size_t index; // in the commands of the batch
+};
+
+/*
+** Number of milliseconds between checks of the children without a pidfd
+*/
+#define BATCH_POLL_MS 10
+
+/**
+ * Run the @param count commands of @param commands, each the full path to
+ * execute followed by its arguments and NULL, keeping up to
+ * @param max_running of them running at once, so the batch takes about as
+ * long as its slowest commands instead of the sum of all of them. Children
+ * are reaped as they exit, through a pidfd each polled in a single loop.
+ * @param results receives the outcome of each command, in the order of
+ * @param commands, with a status of -1 for those that were never started
+ * @return true if every command ran and exited with status 0
+ */
+bool do_exec_batch(char *const *const commands[], size_t count,
+                   size_t max_running, struct exec_result results[]) {
+  if (max_running == 0) {
+    max_running = 1;
+  }
+  // commands never started, on any failure, keep these
+  for (size_t i = 0; i < count; ++i) {
+    results[i] = (struct exec_result){.status = -1};
+  }
+
+  struct batch_child *running =
+      (struct batch_child *)calloc(max_running, sizeof(struct batch_child));
+  struct pollfd *pfds =
+      (struct pollfd *)calloc(max_running, sizeof(struct pollfd));
+  if (running == NULL || pfds == NULL) {
+    free(running);
+    free(pfds);
     return false;
   }
 
-  if (status != 0) {
-    return 0;
+  bool ret = true;
+  size_t nrunning = 0;
+  size_t next = 0;
+  while (next < count || nrunning > 0) {
+    while (next < count && nrunning < max_running) {
+      struct batch_child *child = &running[nrunning];
+      child->index = next++;
+      results[child->index].start_ns = now_ns();
+      if (posix_spawn(&child->pid, commands[child->index][0], NULL, NULL,
+                      commands[child->index], environ) != 0) {
+        ret = false;
+        continue;
+      }
+      child->pidfd = open_pidfd(child->pid);
+      pfds[nrunning] = (struct pollfd){.fd = child->pidfd, .events = POLLIN};
+      ++nrunning;
+    }
+    if (nrunning == 0) {
+      break;
+    }
+
+    // poll() skips the negative fds, check those children periodically
+    bool unwatched = false;
+    for (size_t k = 0; k < nrunning; ++k) {
+      unwatched |= running[k].pidfd < 0;
+    }
+    if (is_error(poll(pfds, nrunning, unwatched ? BATCH_POLL_MS : -1))) {
+      if (errno != EINTR) {
+        ret = false;
+        break;
+      }
+      continue;
+    }
+
+    for (size_t k = 0; k < nrunning;) {
+      struct batch_child *child = &running[k];
+      if (child->pidfd >= 0 && !(pfds[k].revents & POLLIN)) {
+        ++k;
+        continue;
+      }
+
+      int status;
+      struct rusage usage;
+      pid_t pid = wait4(child->pid, &status, WNOHANG, &usage);
+      if (pid == 0 || (is_error(pid) && errno == EINTR)) {
+        ++k;
+        continue;
+      }
+
+      struct exec_result *result = &results[child->index];
+      if (pid == child->pid) {
+        result->status = status;
+        result->wall_ns = now_ns() - result->start_ns;
+        result->cpu_ns =
+            timeval_ns(usage.ru_utime) + timeval_ns(usage.ru_stime);
+      }
+      if (pid != child->pid || !WIFEXITED(status) ||
+          WEXITSTATUS(status) != 0) {
+        ret = false;
+      }
+
+      if (child->pidfd >= 0) {
+        close(child->pidfd);
+      }
+      // the last running child takes this slot
+      --nrunning;
+      running[k] = running[nrunning];
+      pfds[k] = pfds[nrunning];
+    }
   }
 
-  va_end(args);
+  // only left running when poll() failed
+  for (size_t k = 0; k < nrunning; ++k) {
+    int status;
+    waitpid(running[k].pid, &status, 0);
+    if (running[k].pidfd >= 0) {
+      close(running[k].pidfd);
+    }
+  }
+
+  free(running);
+  free(pfds);
+  return ret;
+}
 
+/*
+** Bytes read from the output pipes at once
+*/
+#define CAPTURE_CHUNK_SIZE (64 * 1024)
+
+/*
+** Size requested for the pipes between a command and its reader
+*/
+#define PIPE_BUFFER_SIZE (1024 * 1024)
+
+/*
+** Append the @param size bytes at @param data to the NUL terminated buffer
+** *@param buf of *@param size_rtn bytes and *@param capacity bytes allocated,
+** doubling its allocation when full
+*/
+static bool append_output(char **buf, size_t *size_rtn, size_t *capacity,
+                          const char *data, size_t size) {
+  if (*size_rtn + size + 1 > *capacity) {
+    size_t new_capacity = *capacity ? *capacity : CAPTURE_CHUNK_SIZE;
+    while (*size_rtn + size + 1 > new_capacity) {
+      new_capacity *= 2;
+    }
+    char *new_buf = (char *)realloc(*buf, new_capacity);
+    if (new_buf == NULL) {
+      return false;
+    }
+    *buf = new_buf;
+    *capacity = new_capacity;
+  }
+
+  memcpy(*buf + *size_rtn, data, size);
+  *size_rtn += size;
+  (*buf)[*size_rtn] = '\0';
   return true;
 }
 
+/*
+** Move what is available in the pipe @param fd to @param output, stream being
+** the matching STDOUT_FILENO or STDERR_FILENO
+** @return the number of bytes moved, 0 at end of file, -1 on error
+*/
+static ssize_t drain_output(struct exec_output *output, int stream, int fd,
+                            char *chunk, size_t *capacity) {
+  ssize_t n;
+
+  if (stream == STDOUT_FILENO && output->splice_fd != -1) {
+    // the kernel moves the pipe pages to splice_fd, no copy through here
+    n = splice(fd, NULL, output->splice_fd, NULL, CAPTURE_CHUNK_SIZE,
+               SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (!is_error(n) || errno != EINVAL) {
+      return n;
+    }
+    // splice_fd cannot be spliced to, copy instead
+    n = read(fd, chunk, CAPTURE_CHUNK_SIZE);
+    for (ssize_t done = 0; n > 0 && done < n;) {
+      ssize_t w = write(output->splice_fd, chunk + done, n - done);
+      if (is_error(w)) {
+        return -1;
+      }
+      done += w;
+    }
+    return n;
+  }
+
+  n = read(fd, chunk, CAPTURE_CHUNK_SIZE);
+  if (n <= 0) {
+    return n;
+  }
+  if (output->callback != NULL) {
+    output->callback(output->ctx, stream, chunk, n);
+    return n;
+  }
+
+  bool appended;
+  if (stream == STDOUT_FILENO) {
+    appended = append_output(&output->out, &output->out_size, &capacity[0],
+                             chunk, n);
+  } else {
+    appended = append_output(&output->err, &output->err_size, &capacity[1],
+                             chunk, n);
+  }
+  return appended ? n : -1;
+}
+
+/*
+** Open a pipe into @param fds with both ends closed on exec, grown to
+** PIPE_BUFFER_SIZE so a writer wakes its reader less often. Growing is best
+** effort: unprivileged processes are capped by /proc/sys/fs/pipe-max-size and
+** a per user total, past which the pipe keeps its default size.
+** @return true if the pipe was opened
+*/
+static bool open_pipe(int fds[2]) {
+  if (is_error(pipe2(fds, O_CLOEXEC))) {
+    return false;
+  }
+  fcntl(fds[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+  return true;
+}
+
+/*
+** Start @param command, as for spawn_and_wait, with its stdin, stdout and
+** stderr on @param in_fd, @param out_fd and @param err_fd, each left to the
+** caller's when -1. The duplicates lose O_CLOEXEC, every other pipe end of
+** the caller closes on exec.
+** @return the pid of the command, -1 if it could not be started
+*/
+static pid_t spawn_stage(char *const command[], int in_fd, int out_fd,
+                         int err_fd) {
+  int const fds[] = {in_fd, out_fd, err_fd}; // indexed by target fd
+  posix_spawn_file_actions_t actions;
+  pid_t pid = -1;
+
+  if (posix_spawn_file_actions_init(&actions) != 0) {
+    return -1;
+  }
+
+  bool ready = true;
+  for (int target = STDIN_FILENO; ready && target <= STDERR_FILENO;
+       ++target) {
+    if (fds[target] != -1) {
+      ready = posix_spawn_file_actions_adddup2(&actions, fds[target],
+                                               target) == 0;
+    }
+  }
+  if (ready &&
+      posix_spawn(&pid, command[0], &actions, NULL, command, environ) != 0) {
+    pid = -1;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  return pid;
+}
+
+/*
+** Move everything written to the pipes @param out_fd and @param err_fd to
+** @param output until both reach end of file. Both are drained as data
+** arrives, so a writer never blocks on one full pipe while the other waits.
+** @return true if all the output was delivered
+*/
+static bool drain_pipes(struct exec_output *output, int out_fd, int err_fd) {
+  char *chunk = (char *)malloc(CAPTURE_CHUNK_SIZE);
+  size_t capacity[2] = {0, 0};
+  struct pollfd pfds[2] = {{.fd = out_fd, .events = POLLIN},
+                           {.fd = err_fd, .events = POLLIN}};
+  bool delivered = chunk != NULL;
+
+  while (delivered && (pfds[0].fd >= 0 || pfds[1].fd >= 0)) {
+    if (is_error(poll(pfds, 2, -1))) {
+      delivered = errno == EINTR;
+      continue;
+    }
+    for (int k = 0; k < 2; ++k) {
+      if (pfds[k].fd < 0 || !pfds[k].revents) {
+        continue;
+      }
+      ssize_t n = drain_output(output, k ? STDERR_FILENO : STDOUT_FILENO,
+                               pfds[k].fd, chunk, capacity);
+      if (n == 0) {
+        pfds[k].fd = -1; // end of file, poll() skips it from now on
+      } else if (is_error(n) && errno != EINTR && errno != EAGAIN) {
+        delivered = false;
+      }
+    }
+  }
+
+  free(chunk);
+  return delivered;
+}
+
 /**
- * @param outputfile - The full path to the file to write with command output.
- *   This file will be closed at completion of the function call.
- * All other parameters, see do_exec above
+ * Run a command like do_exec, capturing its stdout and stderr through pipes
+ * instead of a file, into @param output. Both pipes are drained as the
+ * command writes, so it never blocks on a full pipe whatever the size of
+ * its output.
+ * @return true if the command ran, exited with status 0 and all its output
+ * was delivered
  */
-bool do_exec_redirect(const char *outputfile, int count, ...) {
+bool do_exec_capture(struct exec_output *output, int count, ...) {
   va_list args;
   va_start(args, count);
   char *command[count + 1];
@@ -89,34 +478,110 @@ bool do_exec_redirect(const char *outputfile, int count, ...) {
     command[i] = va_arg(args, char *);
   }
   command[count] = NULL;
-  // this line is to avoid a compile warning before your implementation is
-  // complete and may be removed
-  command[count] = command[count];
+  va_end(args);
 
-  int fd = open(outputfile, O_WRONLY | O_TRUNC | O_CREAT, 0644);
-  if (is_error(fd)) {
+  output->out = output->err = NULL;
+  output->out_size = output->err_size = 0;
+
+  int out_pipe[2];
+  int err_pipe[2];
+  if (!open_pipe(out_pipe)) {
     return false;
   }
-
-  pid_t pid = fork();
-  int status;
-  if (is_error(pid)) {
+  if (!open_pipe(err_pipe)) {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
     return false;
-  } else if (pid == 0) {
-    if (dup2(fd, 1) < 0) {
-      return false;
-    }
-    execv(command[0], command);
-    exit(-1);
   }
 
-  if (is_error(waitpid(pid, &status, 0))) {
-    return false;
-  } else if (WIFEXITED(status)) {
-    return WEXITSTATUS(status) == 0;
+  pid_t pid = spawn_stage(command, -1, out_pipe[1], err_pipe[1]);
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+
+  bool delivered =
+      !is_error(pid) && drain_pipes(output, out_pipe[0], err_pipe[0]);
+  close(out_pipe[0]);
+  close(err_pipe[0]);
+
+  // closing the read ends unblocks a command still writing after a failure
+  return !is_error(pid) && wait_success(pid) && delivered;
+}
+
+/**
+ * Run the @param count commands of @param commands, each given as for
+ * do_exec_batch, as a pipeline: the stdout of each command is the stdin of
+ * the next through a pipe, so the stages stream to each other with no file in
+ * between. The first command reads the stdin of the caller.
+ * @param output receives the stdout of the last command and the stderr of
+ * every command as for do_exec_capture, splice_fd included, or is NULL to
+ * leave both to the caller's
+ * @param statuses receives the waitpid() status of each command, -1 for a
+ * command that could not be started
+ * @return true if every command ran and exited with status 0 and all the
+ * output was delivered
+ */
+bool do_pipeline(char *const *const commands[], size_t count,
+                 struct exec_output *output, int statuses[]) {
+  int out_pipe[2] = {-1, -1};
+  int err_pipe[2] = {-1, -1};
+  pid_t pids[count + 1];
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    pids[i] = -1;
+    statuses[i] = -1;
+  }
+  if (output != NULL) {
+    output->out = output->err = NULL;
+    output->out_size = output->err_size = 0;
   }
 
-  va_end(args);
+  bool ret = output == NULL || (open_pipe(out_pipe) && open_pipe(err_pipe));
+  int in_fd = -1; // read end of the pipe from the previous command
+  for (i = 0; ret && i < count; ++i) {
+    int next[2] = {-1, -1};
+    if (i + 1 < count && !open_pipe(next)) {
+      ret = false;
+      break;
+    }
 
-  return true;
+    // the last command writes to out_pipe, or the caller's stdout
+    pids[i] = spawn_stage(commands[i], in_fd,
+                          i + 1 < count ? next[1] : out_pipe[1], err_pipe[1]);
+    if (in_fd != -1) {
+      close(in_fd);
+    }
+    if (next[1] != -1) {
+      close(next[1]);
+    }
+    in_fd = next[0];
+  }
+  if (in_fd != -1) {
+    close(in_fd);
+  }
+
+  // only the commands hold the write ends now, end of file once they exit
+  for (int k = 0; k < 2; ++k) {
+    int *fds = k ? err_pipe : out_pipe;
+    if (fds[1] != -1) {
+      close(fds[1]);
+    }
+  }
+  if (ret && output != NULL) {
+    ret = drain_pipes(output, out_pipe[0], err_pipe[0]);
+  }
+  for (int k = 0; k < 2; ++k) {
+    int *fds = k ? err_pipe : out_pipe;
+    if (fds[0] != -1) {
+      close(fds[0]);
+    }
+  }
+
+  for (i = 0; i < count; ++i) {
+    if (!is_error(pids[i])) {
+      statuses[i] = wait_status(pids[i]);
+    }
+    ret = status_success(statuses[i]) && ret;
+  }
+  return ret;
 }
@@ -1,5 +1,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 bool do_system(const char *command);
@@ -7,3 +9,42 @@ bool do_system(const char *command);
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/*
+** Outcome of one command run by do_exec_batch
+*/
+struct exec_result {
+  int status;        // waitpid() status, -1 if the command could not be started
+  uint64_t start_ns; // CLOCK_MONOTONIC time the command was launched at
+  uint64_t wall_ns;  // from the launch of the command to its exit
+  uint64_t cpu_ns;  // user and system CPU time used by the command
+};
+
+bool do_exec_batch(char *const *const commands[], size_t count,
+                   size_t max_running, struct exec_result results[]);
+
+/*
+** Destination of the output of a command run by do_exec_capture, initialized
+** with EXEC_OUTPUT_INIT and then any of callback or splice_fd
+*/
+struct exec_output {
+  // stdout and stderr of the command, NUL terminated, to be freed by the
+  // caller, unless they go to callback or splice_fd
+  char *out;
+  size_t out_size;
+  char *err;
+  size_t err_size;
+  // receives each chunk of output as it arrives instead of out and err,
+  // stream being STDOUT_FILENO or STDERR_FILENO
+  void (*callback)(void *ctx, int stream, const char *data, size_t size);
+  void *ctx;
+  // when not -1, stdout is moved to this fd with splice() instead
+  int splice_fd;
+};
+
+#define EXEC_OUTPUT_INIT {.splice_fd = -1}
+
+bool do_exec_capture(struct exec_output *output, int count, ...);
+
+bool do_pipeline(char *const *const commands[], size_t count,
+                 struct exec_output *output, int statuses[]);
@@ -0,0 +1,246 @@
+/**
+ * @file aesd-lockfree-bench.c
+ * @brief Contention benchmark of aesd_lockfree_buffer against a mutex
+ *
+ * Producer threads hand records to one consumer thread, in batches, through
+ * either an aesd_lockfree_buffer or an aesd_circular_buffer guarded by a
+ * pthread mutex like fptr_mutex. Both rings hold
+ * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries. The consumer checks that
+ * the records of each producer arrive in order and none is lost.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aesd-lockfree-buffer.h"
+
+#define DEFAULT_RECORDS 2000000
+#define DEFAULT_MAX_PRODUCERS 4
+#define DEFAULT_BATCH 16
+
+struct mutex_buffer {
+  pthread_mutex_t mutex;
+  struct aesd_circular_buffer buffer;
+};
+
+struct bench {
+  bool lockfree;
+  struct aesd_lockfree_buffer lockfree_buffer;
+  struct mutex_buffer mutex_buffer;
+  int producers;
+  size_t batch;
+  size_t records; // per producer
+};
+
+/*
+** Records carry their producer as buffptr and their sequence number as size
+*/
+struct producer {
+  pthread_t thread;
+  struct bench *bench;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool mutex_publish(struct mutex_buffer *m,
+                          const struct aesd_buffer_entry *entries,
+                          size_t count) {
+  struct aesd_buffer_entry dropped;
+
+  pthread_mutex_lock(&m->mutex);
+  if (aesd_entry_ring_count(&m->buffer) + count >
+      AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+    pthread_mutex_unlock(&m->mutex);
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    aesd_entry_ring_push(&m->buffer, &entries[i], &dropped);
+  }
+  pthread_mutex_unlock(&m->mutex);
+  return true;
+}
+
+static size_t mutex_consume(struct mutex_buffer *m,
+                            struct aesd_buffer_entry *entries, size_t count) {
+  size_t done = 0;
+
+  pthread_mutex_lock(&m->mutex);
+  while (done < count && aesd_entry_ring_count(&m->buffer)) {
+    entries[done++] = aesd_entry_ring_pop(&m->buffer);
+  }
+  pthread_mutex_unlock(&m->mutex);
+  return done;
+}
+
+static void *producer_thread(void *arg) {
+  struct producer *producer = (struct producer *)arg;
+  struct bench *bench = producer->bench;
+  struct aesd_buffer_entry *entries =
+      calloc(bench->batch, sizeof(struct aesd_buffer_entry));
+  if (entries == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+
+  for (size_t sent = 0; sent < bench->records;) {
+    size_t count = bench->records - sent < bench->batch ? bench->records - sent
+                                                        : bench->batch;
+    for (size_t i = 0; i < count; ++i) {
+      entries[i] = (struct aesd_buffer_entry){
+          .buffptr = (const char *)producer, .size = sent + i};
+    }
+
+    bool published =
+        bench->lockfree
+            ? aesd_lockfree_buffer_publish(&bench->lockfree_buffer, entries,
+                                           count)
+            : mutex_publish(&bench->mutex_buffer, entries, count);
+    if (published) {
+      sent += count;
+    } else {
+      sched_yield();
+    }
+  }
+
+  free(entries);
+  return NULL;
+}
+
+/*
+** Consume every record on the calling thread.
+** Returns false when a record was lost or reordered.
+*/
+static bool consume_all(struct bench *bench, struct producer *producers) {
+  size_t total = bench->records * bench->producers;
+  size_t *next = calloc(bench->producers, sizeof(size_t));
+  struct aesd_buffer_entry *entries =
+      calloc(bench->batch, sizeof(struct aesd_buffer_entry));
+  bool ok = next != NULL && entries != NULL;
+
+  for (size_t received = 0; ok && received < total;) {
+    size_t count =
+        bench->lockfree
+            ? aesd_lockfree_buffer_consume(&bench->lockfree_buffer, entries,
+                                           bench->batch)
+            : mutex_consume(&bench->mutex_buffer, entries, bench->batch);
+    if (count == 0) {
+      sched_yield();
+      continue;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      size_t id = (const struct producer *)entries[i].buffptr - producers;
+      if (id >= (size_t)bench->producers || entries[i].size != next[id]++) {
+        ok = false;
+      }
+    }
+    received += count;
+  }
+
+  free(entries);
+  free(next);
+  return ok;
+}
+
+static void run(struct bench *bench, size_t total_records) {
+  struct producer *producers = calloc(bench->producers, sizeof(*producers));
+  if (producers == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+
+  bench->records = total_records / bench->producers;
+  if (bench->lockfree) {
+    if (aesd_lockfree_buffer_init(&bench->lockfree_buffer,
+                                  AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                                  bench->producers == 1
+                                      ? AESD_LOCKFREE_SPSC
+                                      : AESD_LOCKFREE_MPSC) != 0) {
+      perror("aesd_lockfree_buffer_init");
+      exit(1);
+    }
+  } else {
+    pthread_mutex_init(&bench->mutex_buffer.mutex, NULL);
+    memset(&bench->mutex_buffer.buffer, 0, sizeof(bench->mutex_buffer.buffer));
+  }
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < bench->producers; ++i) {
+    producers[i].bench = bench;
+    pthread_create(&producers[i].thread, NULL, producer_thread, &producers[i]);
+  }
+  bool ok = consume_all(bench, producers);
+  for (int i = 0; i < bench->producers; ++i) {
+    pthread_join(producers[i].thread, NULL);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  size_t records = bench->records * bench->producers;
+  printf("%-8s producers=%-2d batch=%-4zu records=%-8zu %8.1f ns/record "
+         "%8.2f Mrecords/s%s\n",
+         bench->lockfree ? "lockfree" : "mutex", bench->producers,
+         bench->batch, records, (double)elapsed / records,
+         (double)records / elapsed * 1e3, ok ? "" : "  LOST OR REORDERED");
+  if (!ok) {
+    exit(1);
+  }
+
+  if (bench->lockfree) {
+    aesd_lockfree_buffer_destroy(&bench->lockfree_buffer);
+  } else {
+    pthread_mutex_destroy(&bench->mutex_buffer.mutex);
+  }
+  free(producers);
+}
+
+int main(int argc, char **argv) {
+  size_t records = DEFAULT_RECORDS;
+  int max_producers = DEFAULT_MAX_PRODUCERS;
+  size_t batch = DEFAULT_BATCH;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:p:b:")) != -1) {
+    switch (c) {
+    case 'n':
+      records = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      max_producers = atoi(optarg);
+      break;
+    case 'b':
+      batch = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n records] [-p max_producers] [-b batch]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (records == 0 || max_producers <= 0 || batch == 0 ||
+      batch > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+    fprintf(stderr, "values must be positive, batch at most %d\n",
+            AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    return 1;
+  }
+
+  printf("capacity=%d\n", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+  for (int producers = 1; producers <= max_producers; producers *= 2) {
+    for (int lockfree = 0; lockfree <= 1; ++lockfree) {
+      struct bench bench = {
+          .lockfree = lockfree, .producers = producers, .batch = batch};
+      run(&bench, records);
+    }
+  }
+  return 0;
+}
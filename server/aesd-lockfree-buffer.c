@@ -0,0 +1,151 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "aesd-lockfree-buffer.h"
+
+/*
+** Initialize @param buffer to hold up to @param capacity entries, a power of
+** two, shared in @param mode.
+** Returns 0, or -1 with errno set.
+*/
+int aesd_lockfree_buffer_init(struct aesd_lockfree_buffer *buffer,
+                              size_t capacity, enum aesd_lockfree_mode mode) {
+  if (!AESD_RING_IS_POWER_OF_2(capacity)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  buffer->slots = (struct aesd_lockfree_slot *)aligned_alloc(
+      AESD_CACHE_LINE_SIZE,
+      ((capacity * sizeof(struct aesd_lockfree_slot) + AESD_CACHE_LINE_SIZE -
+        1) /
+       AESD_CACHE_LINE_SIZE) *
+          AESD_CACHE_LINE_SIZE);
+  if (buffer->slots == NULL) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < capacity; ++i) {
+    atomic_init(&buffer->slots[i].seq, i);
+  }
+  atomic_init(&buffer->in_offs, 0);
+  atomic_init(&buffer->out_offs, 0);
+  buffer->capacity = capacity;
+  buffer->mode = mode;
+  return 0;
+}
+
+void aesd_lockfree_buffer_destroy(struct aesd_lockfree_buffer *buffer) {
+  free(buffer->slots);
+  buffer->slots = NULL;
+}
+
+/*
+** Claim the @param count positions following in_offs.
+** Returns the first one, or UINT64_MAX when the ring lacks room.
+*/
+static uint64_t claim(struct aesd_lockfree_buffer *buffer, size_t count) {
+  uint64_t pos = atomic_load_explicit(&buffer->in_offs, memory_order_relaxed);
+
+  for (;;) {
+    // the consumer frees slots in order, so the last one free means all are
+    uint64_t last = pos + count - 1;
+    uint64_t seq = atomic_load_explicit(
+        &buffer->slots[last & (buffer->capacity - 1)].seq,
+        memory_order_acquire);
+    if (seq != last) {
+      // older entries are not consumed yet, or another producer moved on
+      uint64_t now =
+          atomic_load_explicit(&buffer->in_offs, memory_order_relaxed);
+      if (now == pos) {
+        return UINT64_MAX;
+      }
+      pos = now;
+      continue;
+    }
+
+    if (buffer->mode == AESD_LOCKFREE_SPSC) {
+      atomic_store_explicit(&buffer->in_offs, pos + count,
+                            memory_order_relaxed);
+      return pos;
+    }
+    if (atomic_compare_exchange_weak_explicit(&buffer->in_offs, &pos,
+                                              pos + count, memory_order_relaxed,
+                                              memory_order_relaxed)) {
+      return pos;
+    }
+  }
+}
+
+/*
+** Publish the @param count entries at @param entries as one batch, with a
+** single claim of their positions. All of them or none are published.
+** Returns false when the ring lacks room for all of them.
+*/
+bool aesd_lockfree_buffer_publish(struct aesd_lockfree_buffer *buffer,
+                                  const struct aesd_buffer_entry *entries,
+                                  size_t count) {
+  if (count == 0) {
+    return true;
+  }
+  if (count > buffer->capacity) {
+    return false;
+  }
+
+  uint64_t pos = claim(buffer, count);
+  if (pos == UINT64_MAX) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    struct aesd_lockfree_slot *slot =
+        &buffer->slots[(pos + i) & (buffer->capacity - 1)];
+    slot->entry = entries[i];
+    atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+  }
+  return true;
+}
+
+bool aesd_lockfree_buffer_add_entry(struct aesd_lockfree_buffer *buffer,
+                                    const struct aesd_buffer_entry *entry) {
+  return aesd_lockfree_buffer_publish(buffer, entry, 1);
+}
+
+/*
+** Move up to @param count published entries, oldest first, to @param entries.
+** Must only be called by the consumer thread.
+** Returns the number of entries moved.
+*/
+size_t aesd_lockfree_buffer_consume(struct aesd_lockfree_buffer *buffer,
+                                    struct aesd_buffer_entry *entries,
+                                    size_t count) {
+  uint64_t pos = atomic_load_explicit(&buffer->out_offs, memory_order_relaxed);
+  size_t done = 0;
+
+  for (; done < count; ++done) {
+    struct aesd_lockfree_slot *slot =
+        &buffer->slots[(pos + done) & (buffer->capacity - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) !=
+        pos + done + 1) {
+      break;
+    }
+    entries[done] = slot->entry;
+  }
+
+  for (size_t i = 0; i < done; ++i) {
+    atomic_store_explicit(
+        &buffer->slots[(pos + i) & (buffer->capacity - 1)].seq,
+        pos + i + buffer->capacity, memory_order_release);
+  }
+  atomic_store_explicit(&buffer->out_offs, pos + done, memory_order_relaxed);
+  return done;
+}
+
+/*
+** Returns the number of entries claimed and not consumed yet, exact only when
+** no other thread is using @param buffer.
+*/
+size_t aesd_lockfree_buffer_count(struct aesd_lockfree_buffer *buffer) {
+  return atomic_load_explicit(&buffer->in_offs, memory_order_relaxed) -
+         atomic_load_explicit(&buffer->out_offs, memory_order_relaxed);
+}
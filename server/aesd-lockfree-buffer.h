@@ -0,0 +1,55 @@
+#ifndef AESD_LOCKFREE_BUFFER_H_
+#define AESD_LOCKFREE_BUFFER_H_
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+
+#define AESD_CACHE_LINE_SIZE 64
+
+enum aesd_lockfree_mode {
+  AESD_LOCKFREE_SPSC, // one producer thread, one consumer thread
+  AESD_LOCKFREE_MPSC, // any number of producer threads, one consumer thread
+};
+
+struct aesd_lockfree_slot {
+  /*
+  ** position + 1 once the entry at position is published, position + capacity
+  ** once it is consumed and the slot can take the next one
+  */
+  _Atomic uint64_t seq;
+  struct aesd_buffer_entry entry;
+};
+
+/*
+** Ring of struct aesd_buffer_entry shared by producer threads and one consumer
+** thread without a mutex. Unlike aesd_circular_buffer it never overwrites an
+** entry that was not consumed: producers are told the ring is full instead.
+** The producer and consumer positions live on their own cache lines.
+*/
+struct aesd_lockfree_buffer {
+  alignas(AESD_CACHE_LINE_SIZE) _Atomic uint64_t in_offs;
+  alignas(AESD_CACHE_LINE_SIZE) _Atomic uint64_t out_offs;
+  alignas(AESD_CACHE_LINE_SIZE) struct aesd_lockfree_slot *slots;
+  size_t capacity;
+  enum aesd_lockfree_mode mode;
+};
+
+int aesd_lockfree_buffer_init(struct aesd_lockfree_buffer *buffer,
+                              size_t capacity, enum aesd_lockfree_mode mode);
+void aesd_lockfree_buffer_destroy(struct aesd_lockfree_buffer *buffer);
+bool aesd_lockfree_buffer_publish(struct aesd_lockfree_buffer *buffer,
+                                  const struct aesd_buffer_entry *entries,
+                                  size_t count);
+bool aesd_lockfree_buffer_add_entry(struct aesd_lockfree_buffer *buffer,
+                                    const struct aesd_buffer_entry *entry);
+size_t aesd_lockfree_buffer_consume(struct aesd_lockfree_buffer *buffer,
+                                    struct aesd_buffer_entry *entries,
+                                    size_t count);
+size_t aesd_lockfree_buffer_count(struct aesd_lockfree_buffer *buffer);
+
+#endif // AESD_LOCKFREE_BUFFER_H_
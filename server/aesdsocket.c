@@ -1,10 +1,14 @@
+#define _GNU_SOURCE // SEEK_DATA
+
 #include <errno.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
 
 #include "aesdsocket.h"
 
@@ -15,6 +19,8 @@ bool should_close = false;
 static void signal_handler(int signo);
 void *time_writer_work(void *arg);
 struct aesd_seekto *seekto_arg = NULL;
+char *search_pattern = NULL;
+size_t search_len = 0;
 
 static void *thread_work(void *arg) {
   thread_info_t *tinfo = (thread_info_t *)arg;
@@ -27,8 +33,14 @@ static void *thread_work(void *arg) {
     exit(1);
   }
 
-  recv_to_file(tinfo->fd);
-  send_file(tinfo->fd);
+  // nothing is sent back for a request that could not be handled
+  if (recv_to_file(tinfo->fd)) {
+    if (search_pattern != NULL) {
+      send_matches(tinfo->fd);
+    } else {
+      send_file(tinfo->fd);
+    }
+  }
 
   fclose(fptr);
   pthread_mutex_unlock(&fptr_mutex);
@@ -132,8 +144,17 @@ int main(int argc, char **argv) {
   return 0;
 }
 
-void recv_to_file(int fd) {
+/*
+** Receive a request, writing its data to the file or keeping the command it
+** carries for the reply.
+** Returns false when the request could not be handled.
+*/
+bool recv_to_file(int fd) {
   char *recv_buf = (char *)malloc(MAXDATASIZE);
+  if (recv_buf == NULL) {
+    ERROR_LOG("malloc");
+    return false;
+  }
 
   int bytes_recv;
   do {
@@ -149,6 +170,23 @@ void recv_to_file(int fd) {
       char *end;
       seekto_arg->write_cmd = strtoul(recv_buf + strlen(COMMAND), &end, 10);
       seekto_arg->write_cmd_offset = strtoul(end + 1, &end, 10);
+    } else if (bytes_recv > 0 &&
+               strncmp(recv_buf, SEARCH_COMMAND, strlen(SEARCH_COMMAND)) == 0) {
+      DEBUG_LOG("received search: %.*s", bytes_recv, recv_buf);
+      search_len = bytes_recv - strlen(SEARCH_COMMAND);
+      while (search_len > 0 &&
+             (recv_buf[strlen(SEARCH_COMMAND) + search_len - 1] == '\n' ||
+              recv_buf[strlen(SEARCH_COMMAND) + search_len - 1] == '\r')) {
+        search_len--;
+      }
+      free(search_pattern);
+      search_pattern = (char *)malloc(search_len + 1);
+      if (search_pattern == NULL) {
+        ERROR_LOG("malloc");
+        free(recv_buf);
+        return false;
+      }
+      memcpy(search_pattern, recv_buf + strlen(SEARCH_COMMAND), search_len);
     } else {
       DEBUG_LOG("receive from client: %s", recv_buf);
       fwrite(recv_buf, bytes_recv, 1, fptr);
@@ -156,20 +194,200 @@ void recv_to_file(int fd) {
   } while (bytes_recv == MAXDATASIZE);
 
   free(recv_buf);
+  return true;
 }
 
 void send_file(int fd) {
-  fseek(fptr, 0, SEEK_SET); // seek to begin of file
-  ioctl(fileno(fptr), AESDCHAR_IOCSEEKTO, seekto_arg);
-  free(seekto_arg);
-  seekto_arg=NULL;
+  // offsets of the char device never restart at 0, seek to its oldest data
+  fflush(fptr);
+  lseek(fileno(fptr), 0, SEEK_DATA);
+  if (seekto_arg != NULL) {
+    ioctl(fileno(fptr), AESDCHAR_IOCSEEKTO, seekto_arg);
+    free(seekto_arg);
+    seekto_arg = NULL;
+  }
+
+  // the kernel moves the data to the socket, no copy through user space
+  ssize_t sent;
+  while ((sent = sendfile(fd, fileno(fptr), NULL, SENDFILESIZE)) > 0) {
+    DEBUG_LOG("Sent %zd bytes to client", sent);
+  }
+  if (is_error(sent)) {
+    ERROR_LOG("sendfile");
+  }
+}
+
+/*
+** Read the records of the file into *data, their sizes into *sizes and the
+** sequence number of the first one into *first_seq.
+** Returns the number of records, or -1.
+*/
+static ssize_t read_records(char **data, uint64_t **sizes,
+                            uint64_t *first_seq) {
+#if USE_AESD_CHAR_DEVICE == 1
+  // one snapshot holds the records, their sizes and sequence numbers
+  struct aesd_snapshot snapshot = {.buf = 0, .size = 0};
+  char *buf = NULL;
+
+  while (ioctl(fileno(fptr), AESDCHAR_IOCEXPORT, &snapshot) != 0) {
+    if (errno != ERANGE) {
+      ERROR_LOG("AESDCHAR_IOCEXPORT");
+      free(buf);
+      return -1;
+    }
+    // grown since the size was reported, ask again
+    free(buf);
+    buf = (char *)malloc(snapshot.size);
+    if (buf == NULL) {
+      return -1;
+    }
+    snapshot.buf = (uintptr_t)buf;
+  }
+
+  struct aesd_snapshot_header header;
+  memcpy(&header, buf, sizeof(header));
+  size_t sizes_len = header.count * sizeof(uint64_t);
+  *sizes = (uint64_t *)malloc(sizes_len + 1);
+  *data = (char *)malloc(snapshot.size - sizeof(header) - sizes_len + 1);
+  if (*sizes == NULL || *data == NULL) {
+    free(*sizes);
+    free(*data);
+    free(buf);
+    return -1;
+  }
+  memcpy(*sizes, buf + sizeof(header), sizes_len);
+  memcpy(*data, buf + sizeof(header) + sizes_len,
+         snapshot.size - sizeof(header) - sizes_len);
+  *first_seq = header.first_seq;
+  free(buf);
+  return header.count;
+#else
+  // records are the lines of the file, numbered from 0
+  long size;
+  if (fseek(fptr, 0, SEEK_END) != 0 || (size = ftell(fptr)) < 0) {
+    return -1;
+  }
+  rewind(fptr);
+
+  *data = (char *)malloc(size + 1);
+  if (*data == NULL || fread(*data, 1, size, fptr) != (size_t)size) {
+    free(*data);
+    return -1;
+  }
 
-  char sendbuffer[124];
-  int b;
-  while ((b = fread(sendbuffer, 1, sizeof(sendbuffer), fptr)) > 0) {
-    DEBUG_LOG("Sending to client: %s", sendbuffer);
-    send(fd, sendbuffer, b, 0);
+  // count the lines first, the last one possibly without its '\n', so the
+  // sizes take 8 bytes per record rather than per byte of the file
+  const char *end = *data + size;
+  const char *line;
+  const char *newline;
+  ssize_t count = 0;
+  for (line = *data; line < end; ++count) {
+    newline = (const char *)memchr(line, '\n', end - line);
+    line = newline ? newline + 1 : end;
+  }
+
+  *sizes = (uint64_t *)malloc(count * sizeof(uint64_t) + 1);
+  if (*sizes == NULL) {
+    free(*data);
+    return -1;
+  }
+  ssize_t i = 0;
+  for (line = *data; line < end; ++i) {
+    newline = (const char *)memchr(line, '\n', end - line);
+    const char *next = newline ? newline + 1 : end;
+    (*sizes)[i] = next - line;
+    line = next;
+  }
+  *first_seq = 0;
+  return count;
+#endif
+}
+
+/*
+** Send every record holding part of a match of search_pattern, a match
+** possibly spanning several records, as "<sequence number>:<record>"
+*/
+void send_matches(int fd) {
+  char *data;
+  uint64_t *sizes;
+  uint64_t first_seq;
+  char *reply = NULL;
+  size_t reply_size = 0;
+
+  fflush(fptr);
+  ssize_t count = read_records(&data, &sizes, &first_seq);
+  if (count < 0) {
+    ERROR_LOG("could not read the records to search");
+    goto out;
+  }
+
+  FILE *out = open_memstream(&reply, &reply_size);
+  if (out == NULL) {
+    ERROR_LOG("open_memstream");
+    goto out_free;
+  }
+
+  struct aesd_buffer_entry *records = (struct aesd_buffer_entry *)malloc(
+      (count + 1) * sizeof(struct aesd_buffer_entry));
+  if (records == NULL) {
+    ERROR_LOG("malloc");
+    fclose(out);
+    goto out_free;
+  }
+  const char *record_data = data;
+  for (ssize_t i = 0; i < count; ++i) {
+    records[i] = (struct aesd_buffer_entry){.buffptr = record_data,
+                                            .size = sizes[i]};
+    record_data += sizes[i];
+  }
+
+  // the matcher of aesd_circular_buffer_search, across record boundaries
+  struct aesd_buffer_entries const entries = {
+      .entry = records, .capacity = count, .first = 0, .count = count};
+  size_t record = 0;        // record holding the current match
+  size_t record_offset = 0; // its first byte in that record
+  size_t sent = 0;          // records before this one were sent
+  while (aesd_buffer_entries_search(&entries, &record, &record_offset,
+                                    search_pattern, search_len)) {
+    // bytes of the match from the start of the current record on
+    size_t left = record_offset + (search_len ? search_len : 1);
+    for (size_t next = record; next < (size_t)count && left > 0; ++next) {
+      if (next >= sent) {
+        fprintf(out, "%" PRIu64 ":%.*s", first_seq + next, (int)sizes[next],
+                records[next].buffptr);
+        if (records[next].buffptr[sizes[next] - 1] != '\n') {
+          fputc('\n', out);
+        }
+        sent = next + 1;
+      }
+      left = left > sizes[next] ? left - sizes[next] : 0;
+    }
+
+    // look for the next match one byte further
+    if (++record_offset == sizes[record]) {
+      ++record;
+      record_offset = 0;
+    }
+  }
+  free(records);
+  fclose(out);
+
+  for (size_t done = 0; done < reply_size;) {
+    ssize_t n = send(fd, reply + done, reply_size - done, 0);
+    if (is_error(n)) {
+      ERROR_LOG("send");
+      break;
+    }
+    done += n;
   }
+  free(reply);
+
+out_free:
+  free(data);
+  free(sizes);
+out:
+  free(search_pattern);
+  search_pattern = NULL;
 }
 
 void sigchld_handler(int s) {
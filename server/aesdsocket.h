@@ -11,6 +11,7 @@
 #include <sys/wait.h>
 #include <syslog.h>
 #include <unistd.h>
+#include "../aesd-char-driver/aesd-circular-buffer.h"
 #include "../aesd-char-driver/aesd_ioctl.h"
 
 #include "queue.h"
@@ -36,6 +37,8 @@
 
 #define MAXDATASIZE 1024
 
+#define SENDFILESIZE (64 * 1024) // bytes moved per sendfile call
+
 #ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE 1
 #endif
@@ -49,8 +52,13 @@
 
 #define COMMAND "AESDCHAR_IOCSEEKTO:"
 
-void recv_to_file(int fd);
+// answered with "<sequence number>:<record>" for each record holding part of
+// a match of the rest of the line, instead of the whole file
+#define SEARCH_COMMAND "AESDCHAR_SEARCH:"
+
+bool recv_to_file(int fd);
 void send_file(int fd);
+void send_matches(int fd);
 void sigchld_handler(int s);
 // get sockaddr, IPv4 or IPv6:
 void *get_in_addr(struct sockaddr *sa);
@@ -0,0 +1,182 @@
+#include "unity.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+void test_batch_reports_each_command()
+{
+    char *const ok[] = {"/bin/true", NULL};
+    char *const fails[] = {"/bin/sh", "-c", "exit 3", NULL};
+    char *const missing[] = {"true", NULL};
+    char *const *const commands[] = {ok, fails, missing};
+    struct exec_result results[3];
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(commands, 3, 2, results),
+                              "a batch with failing commands should fail");
+    TEST_ASSERT_TRUE(WIFEXITED(results[0].status));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(results[0].status));
+    TEST_ASSERT_TRUE(WIFEXITED(results[1].status));
+    TEST_ASSERT_EQUAL_INT(3, WEXITSTATUS(results[1].status));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, results[2].status,
+                                  "a command without a full path cannot start");
+}
+
+void test_batch_runs_commands_concurrently()
+{
+    char *const nap[] = {"/bin/sleep", "0.5", NULL};
+    char *const spin[] = {"/bin/sh", "-c", "i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done", NULL};
+    char *const *const commands[] = {nap, nap, nap, nap, spin};
+    struct exec_result results[5];
+
+    TEST_ASSERT_TRUE(do_exec_batch(commands, 5, 5, results));
+
+    // one at a time, each sleep would start after the previous one ended
+    uint64_t last_start = 0;
+    uint64_t first_end = UINT64_MAX;
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(results[i].wall_ns >= 500000000ull);
+        if (results[i].start_ns > last_start) {
+            last_start = results[i].start_ns;
+        }
+        if (results[i].start_ns + results[i].wall_ns < first_end) {
+            first_end = results[i].start_ns + results[i].wall_ns;
+        }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(last_start < first_end, "the sleeps should overlap");
+    TEST_ASSERT_TRUE_MESSAGE(results[4].cpu_ns > 0, "the busy loop should use CPU time");
+}
+
+void test_capture_separates_stdout_and_stderr()
+{
+    struct exec_output output = EXEC_OUTPUT_INIT;
+
+    TEST_ASSERT_TRUE(do_exec_capture(&output, 3, "/bin/sh", "-c",
+                                     "echo out; echo err >&2"));
+    TEST_ASSERT_EQUAL_STRING("out\n", output.out);
+    TEST_ASSERT_EQUAL_INT(4, output.out_size);
+    TEST_ASSERT_EQUAL_STRING("err\n", output.err);
+    free(output.out);
+    free(output.err);
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_capture(&output, 3, "/bin/sh", "-c",
+                                              "echo failed >&2; exit 1"),
+                              "a failing command should fail");
+    TEST_ASSERT_EQUAL_STRING("failed\n", output.err);
+    free(output.out);
+    free(output.err);
+}
+
+void test_capture_drains_large_output()
+{
+    struct exec_output output = EXEC_OUTPUT_INIT;
+
+    // far more than a pipe holds on both streams, blocks unless both drain
+    TEST_ASSERT_TRUE(do_exec_capture(&output, 3, "/bin/sh", "-c",
+                                     "head -c 1048576 /dev/zero >&2; "
+                                     "head -c 1048576 /dev/zero"));
+    TEST_ASSERT_EQUAL_INT(1048576, output.out_size);
+    TEST_ASSERT_EQUAL_INT(1048576, output.err_size);
+    free(output.out);
+    free(output.err);
+}
+
+static void count_output(void *ctx, int stream, const char *data, size_t size)
+{
+    size_t *sizes = (size_t *)ctx;
+
+    (void)data;
+    sizes[stream == STDERR_FILENO] += size;
+}
+
+void test_capture_streams_to_callback()
+{
+    struct exec_output output = EXEC_OUTPUT_INIT;
+    size_t sizes[2] = {0, 0};
+
+    output.callback = count_output;
+    output.ctx = sizes;
+    TEST_ASSERT_TRUE(do_exec_capture(&output, 3, "/bin/sh", "-c",
+                                     "head -c 300000 /dev/zero; echo e >&2"));
+    TEST_ASSERT_EQUAL_INT(300000, sizes[0]);
+    TEST_ASSERT_EQUAL_INT(2, sizes[1]);
+    TEST_ASSERT_NULL(output.out);
+}
+
+void test_capture_splices_stdout_to_fd()
+{
+    char path[] = "/tmp/capture-spliceXXXXXX";
+    int fd = mkstemp(path);
+    struct exec_output output = EXEC_OUTPUT_INIT;
+    struct stat st;
+
+    TEST_ASSERT_TRUE(fd >= 0);
+    output.splice_fd = fd;
+    TEST_ASSERT_TRUE(do_exec_capture(&output, 3, "/bin/sh", "-c",
+                                     "head -c 200000 /dev/zero; echo e >&2"));
+    TEST_ASSERT_EQUAL_INT(0, fstat(fd, &st));
+    TEST_ASSERT_EQUAL_INT(200000, st.st_size);
+    TEST_ASSERT_NULL(output.out);
+    TEST_ASSERT_EQUAL_STRING("e\n", output.err);
+    free(output.err);
+    close(fd);
+    unlink(path);
+}
+
+void test_pipeline_streams_between_stages()
+{
+    char *const produce[] = {"/bin/sh", "-c", "head -c 4194304 /dev/zero; echo warn >&2", NULL};
+    char *const pass[] = {"/bin/cat", NULL};
+    char *const count[] = {"/usr/bin/wc", "-c", NULL};
+    char *const *const commands[] = {produce, pass, count};
+    struct exec_output output = EXEC_OUTPUT_INIT;
+    int statuses[3];
+
+    TEST_ASSERT_TRUE(do_pipeline(commands, 3, &output, statuses));
+    TEST_ASSERT_EQUAL_STRING("4194304\n", output.out);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("warn\n", output.err,
+                                     "the stderr of every stage should be captured");
+    for (size_t i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(WIFEXITED(statuses[i]));
+        TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(statuses[i]));
+    }
+    free(output.out);
+    free(output.err);
+}
+
+void test_pipeline_reports_each_stage()
+{
+    char *const produce[] = {"/bin/echo", "abc", NULL};
+    char *const fails[] = {"/bin/sh", "-c", "cat >/dev/null; exit 4", NULL};
+    char *const missing[] = {"tr", "a", "b", NULL};
+    char *const *const commands[] = {produce, fails, missing};
+    int statuses[3];
+    char path[] = "/tmp/pipeline-spliceXXXXXX";
+    int fd = mkstemp(path);
+    struct exec_output output = EXEC_OUTPUT_INIT;
+    char data[8] = {0};
+
+    TEST_ASSERT_TRUE(fd >= 0);
+    output.splice_fd = fd;
+    TEST_ASSERT_FALSE_MESSAGE(do_pipeline(commands, 3, &output, statuses),
+                              "a pipeline with failing stages should fail");
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(statuses[0]));
+    TEST_ASSERT_EQUAL_INT(4, WEXITSTATUS(statuses[1]));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, statuses[2],
+                                  "a command without a full path cannot start");
+    free(output.err);
+
+    char *const upper[] = {"/usr/bin/tr", "a-z", "A-Z", NULL};
+    char *const *const spliced[] = {produce, upper};
+    output.splice_fd = fd;
+    TEST_ASSERT_TRUE(do_pipeline(spliced, 2, &output, statuses));
+    TEST_ASSERT_EQUAL_INT(4, pread(fd, data, sizeof(data) - 1, 0));
+    TEST_ASSERT_EQUAL_STRING("ABC\n", data);
+    free(output.err);
+    close(fd);
+    unlink(path);
+}
@@ -0,0 +1,68 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-arena-buffer.h"
+
+static void add_string(struct aesd_arena_buffer *buffer, const char *str)
+{
+    TEST_ASSERT_TRUE(aesd_arena_buffer_add_entry(buffer, str, strlen(str)));
+}
+
+void test_arena_size_must_be_a_power_of_two()
+{
+    static char data[48];
+    struct aesd_arena_buffer buffer;
+
+    TEST_ASSERT_FALSE(aesd_arena_buffer_init(&buffer, data, 48));
+    TEST_ASSERT_TRUE(aesd_arena_buffer_init(&buffer, data, 32));
+    TEST_ASSERT_FALSE_MESSAGE(aesd_arena_buffer_add_entry(&buffer, data, 33),
+                              "an entry larger than the arena should be rejected");
+    TEST_ASSERT_EQUAL_size_t(0, aesd_arena_buffer_count(&buffer));
+}
+
+void test_arena_evicts_oldest_entries_and_wraps()
+{
+    static char data[16];
+    static char strings[10][8];
+    struct aesd_arena_buffer buffer;
+    TEST_ASSERT_TRUE(aesd_arena_buffer_init(&buffer, data, sizeof(data)));
+
+    // 5 byte entries: the arena holds the last 3 of them
+    for (size_t i = 0; i < 10; i++) {
+        snprintf(strings[i], sizeof(strings[i]), "abc%zu\n", i);
+        add_string(&buffer, strings[i]);
+    }
+    TEST_ASSERT_EQUAL_size_t(3, aesd_arena_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_UINT64(7, aesd_arena_buffer_first_seq(&buffer));
+    TEST_ASSERT_EQUAL_UINT64(35, buffer.tail);
+    TEST_ASSERT_EQUAL_UINT64(50, buffer.head);
+
+    // entry 9 starts at offset 45, byte 13 of the arena, and wraps around
+    size_t offset;
+    const struct aesd_arena_entry *entry =
+        aesd_arena_buffer_find_entry_for_offset(&buffer, 47, &offset);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_UINT64(45, entry->offset);
+    TEST_ASSERT_EQUAL_size_t(2, offset);
+    TEST_ASSERT_NULL(aesd_arena_buffer_find_entry_for_offset(&buffer, 34, &offset));
+    TEST_ASSERT_NULL(aesd_arena_buffer_find_entry_for_offset(&buffer, 50, &offset));
+
+    char out[32];
+    TEST_ASSERT_EQUAL_size_t(15, aesd_arena_buffer_copy(&buffer, 35, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY("abc7\nabc8\nabc9\n", out, 15);
+    TEST_ASSERT_EQUAL_size_t(0, aesd_arena_buffer_copy(&buffer, 30, out, sizeof(out)));
+}
+
+void test_arena_descriptor_count_limits_entries()
+{
+    static char data[256];
+    struct aesd_arena_buffer buffer;
+    TEST_ASSERT_TRUE(aesd_arena_buffer_init(&buffer, data, sizeof(data)));
+
+    for (size_t i = 0; i < AESDCHAR_ARENA_MAX_ENTRIES + 2; i++) {
+        add_string(&buffer, "x");
+    }
+    TEST_ASSERT_EQUAL_size_t(AESDCHAR_ARENA_MAX_ENTRIES, aesd_arena_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_UINT64(2, buffer.tail);
+    TEST_ASSERT_EQUAL_UINT64(2, aesd_arena_buffer_first_seq(&buffer));
+}
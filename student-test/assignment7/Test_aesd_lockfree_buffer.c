@@ -0,0 +1,170 @@
+#include "unity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include "../../server/aesd-lockfree-buffer.h"
+
+#define PRODUCERS 4
+#define ENTRIES_PER_PRODUCER 20000
+
+// entries carry their producer and index in size, no buffer is ever read
+static struct aesd_buffer_entry make_entry(size_t producer, size_t index)
+{
+    struct aesd_buffer_entry entry = {
+        .buffptr = NULL,
+        .size = (producer << 20) | index,
+    };
+    return entry;
+}
+
+void test_lockfree_capacity_must_be_a_power_of_two()
+{
+    struct aesd_lockfree_buffer buffer;
+
+    TEST_ASSERT_EQUAL_INT(-1, aesd_lockfree_buffer_init(&buffer, 6, AESD_LOCKFREE_SPSC));
+    TEST_ASSERT_EQUAL_INT(0, aesd_lockfree_buffer_init(&buffer, 8, AESD_LOCKFREE_SPSC));
+    aesd_lockfree_buffer_destroy(&buffer);
+}
+
+void test_lockfree_publish_then_consume_in_order()
+{
+    struct aesd_lockfree_buffer buffer;
+    struct aesd_buffer_entry entries[5];
+    struct aesd_buffer_entry out[8];
+    TEST_ASSERT_EQUAL_INT(0, aesd_lockfree_buffer_init(&buffer, 8, AESD_LOCKFREE_SPSC));
+
+    TEST_ASSERT_EQUAL_size_t(0, aesd_lockfree_buffer_consume(&buffer, out, 8));
+    for (size_t i = 0; i < 5; i++) {
+        entries[i] = make_entry(0, i);
+    }
+    TEST_ASSERT_TRUE(aesd_lockfree_buffer_add_entry(&buffer, &entries[0]));
+    TEST_ASSERT_TRUE(aesd_lockfree_buffer_publish(&buffer, &entries[1], 4));
+    TEST_ASSERT_EQUAL_size_t(5, aesd_lockfree_buffer_count(&buffer));
+
+    // a short consume leaves the rest for the next one
+    TEST_ASSERT_EQUAL_size_t(2, aesd_lockfree_buffer_consume(&buffer, out, 2));
+    TEST_ASSERT_EQUAL_size_t(3, aesd_lockfree_buffer_consume(&buffer, out + 2, 8));
+    for (size_t i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL_UINT64(i, out[i].size);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, aesd_lockfree_buffer_count(&buffer));
+    aesd_lockfree_buffer_destroy(&buffer);
+}
+
+void test_lockfree_rejects_writes_when_full()
+{
+    struct aesd_lockfree_buffer buffer;
+    struct aesd_buffer_entry entries[5];
+    struct aesd_buffer_entry out[4];
+    TEST_ASSERT_EQUAL_INT(0, aesd_lockfree_buffer_init(&buffer, 4, AESD_LOCKFREE_MPSC));
+
+    for (size_t i = 0; i < 5; i++) {
+        entries[i] = make_entry(0, i);
+    }
+    TEST_ASSERT_FALSE_MESSAGE(aesd_lockfree_buffer_publish(&buffer, entries, 5),
+                              "a batch larger than the ring should be rejected");
+    TEST_ASSERT_TRUE(aesd_lockfree_buffer_publish(&buffer, entries, 3));
+    TEST_ASSERT_FALSE_MESSAGE(aesd_lockfree_buffer_publish(&buffer, &entries[3], 2),
+                              "a batch is published whole or not at all");
+    TEST_ASSERT_EQUAL_size_t(3, aesd_lockfree_buffer_count(&buffer));
+    TEST_ASSERT_TRUE(aesd_lockfree_buffer_add_entry(&buffer, &entries[3]));
+    TEST_ASSERT_FALSE_MESSAGE(aesd_lockfree_buffer_add_entry(&buffer, &entries[4]),
+                              "a full ring should never overwrite an entry");
+
+    // consuming one entry makes room for exactly one more
+    TEST_ASSERT_EQUAL_size_t(1, aesd_lockfree_buffer_consume(&buffer, out, 1));
+    TEST_ASSERT_EQUAL_UINT64(0, out[0].size);
+    TEST_ASSERT_TRUE(aesd_lockfree_buffer_add_entry(&buffer, &entries[4]));
+    TEST_ASSERT_FALSE(aesd_lockfree_buffer_add_entry(&buffer, &entries[0]));
+
+    TEST_ASSERT_EQUAL_size_t(4, aesd_lockfree_buffer_consume(&buffer, out, 4));
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_UINT64(i + 1, out[i].size);
+    }
+    aesd_lockfree_buffer_destroy(&buffer);
+}
+
+void test_lockfree_wraps_around()
+{
+    struct aesd_lockfree_buffer buffer;
+    struct aesd_buffer_entry entries[3];
+    struct aesd_buffer_entry out[3];
+    TEST_ASSERT_EQUAL_INT(0, aesd_lockfree_buffer_init(&buffer, 4, AESD_LOCKFREE_SPSC));
+
+    // batches of 3 in a ring of 4 start at every slot and run past its end
+    size_t next = 0;
+    for (size_t round = 0; round < 10; round++) {
+        for (size_t i = 0; i < 3; i++) {
+            entries[i] = make_entry(0, next + i);
+        }
+        TEST_ASSERT_TRUE(aesd_lockfree_buffer_publish(&buffer, entries, 3));
+        TEST_ASSERT_EQUAL_size_t(3, aesd_lockfree_buffer_consume(&buffer, out, 3));
+        for (size_t i = 0; i < 3; i++) {
+            TEST_ASSERT_EQUAL_UINT64(next + i, out[i].size);
+        }
+        next += 3;
+    }
+    TEST_ASSERT_EQUAL_UINT64(30, atomic_load(&buffer.in_offs));
+    TEST_ASSERT_EQUAL_UINT64(30, atomic_load(&buffer.out_offs));
+    aesd_lockfree_buffer_destroy(&buffer);
+}
+
+struct producer {
+    pthread_t thread;
+    struct aesd_lockfree_buffer *buffer;
+    size_t id;
+};
+
+static void *produce(void *arg)
+{
+    struct producer *producer = (struct producer *)arg;
+
+    for (size_t i = 0; i < ENTRIES_PER_PRODUCER; i++) {
+        struct aesd_buffer_entry entry = make_entry(producer->id, i);
+        while (!aesd_lockfree_buffer_add_entry(producer->buffer, &entry)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void test_lockfree_multiple_producers_publish_every_entry_once()
+{
+    struct aesd_lockfree_buffer buffer;
+    struct producer producers[PRODUCERS];
+    size_t next[PRODUCERS] = {0};
+    struct aesd_buffer_entry out[16];
+    TEST_ASSERT_EQUAL_INT(0, aesd_lockfree_buffer_init(&buffer, 64, AESD_LOCKFREE_MPSC));
+
+    for (size_t p = 0; p < PRODUCERS; p++) {
+        producers[p].buffer = &buffer;
+        producers[p].id = p;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&producers[p].thread, NULL,
+                                                produce, &producers[p]));
+    }
+
+    // each producer's entries arrive in the order it published them
+    size_t consumed = 0;
+    bool in_order = true;
+    while (consumed < PRODUCERS * ENTRIES_PER_PRODUCER) {
+        size_t count = aesd_lockfree_buffer_consume(&buffer, out, 16);
+        for (size_t i = 0; i < count; i++) {
+            size_t p = out[i].size >> 20;
+            size_t index = out[i].size & 0xfffff;
+            in_order = in_order && p < PRODUCERS && index == next[p]++;
+        }
+        consumed += count;
+        if (count == 0) {
+            sched_yield();
+        }
+    }
+
+    for (size_t p = 0; p < PRODUCERS; p++) {
+        pthread_join(producers[p].thread, NULL);
+        TEST_ASSERT_EQUAL_size_t(ENTRIES_PER_PRODUCER, next[p]);
+    }
+    TEST_ASSERT_TRUE_MESSAGE(in_order, "entries were lost, duplicated or reordered");
+    TEST_ASSERT_EQUAL_size_t(0, aesd_lockfree_buffer_consume(&buffer, out, 16));
+    aesd_lockfree_buffer_destroy(&buffer);
+}
@@ -0,0 +1,65 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-ring.h"
+
+struct int_ring16 {
+    AESD_RING_FIELDS(int, 16);
+};
+AESD_RING_DEFINE(int_ring16, struct int_ring16, int, 16)
+
+struct int_ring5 {
+    AESD_RING_FIELDS(int, 5);
+};
+AESD_RING_DEFINE(int_ring5, struct int_ring5, int, 5)
+
+void test_wrap_masks_power_of_two_capacities()
+{
+    TEST_ASSERT_EQUAL_UINT32(0, AESD_RING_WRAP(16u, 16u));
+    TEST_ASSERT_EQUAL_UINT32(15, AESD_RING_WRAP(31u, 16u));
+    TEST_ASSERT_EQUAL_UINT32(0, AESD_RING_WRAP(5u, 5u));
+    TEST_ASSERT_EQUAL_UINT32(4, AESD_RING_WRAP(9u, 5u));
+    TEST_ASSERT_EQUAL_UINT32(3, AESD_RING_WRAP(3u, 5u));
+}
+
+void test_power_of_two_ring_keeps_newest_elements()
+{
+    struct int_ring16 ring;
+    memset(&ring, 0, sizeof(ring));
+
+    int dropped;
+    for (int i = 0; i < 40; i++) {
+        bool was_full = int_ring16_push(&ring, &i, &dropped);
+        TEST_ASSERT_EQUAL(i >= 16, was_full);
+        if (was_full) {
+            TEST_ASSERT_EQUAL_INT(i - 16, dropped);
+        }
+        TEST_ASSERT_EQUAL_size_t(i < 16 ? i + 1 : 16, int_ring16_count(&ring));
+    }
+
+    // holds 24..39, oldest first
+    for (size_t i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL_INT(24 + i, *int_ring16_at(&ring, i));
+    }
+    TEST_ASSERT_EQUAL_INT(24, int_ring16_pop(&ring));
+    TEST_ASSERT_FALSE(ring.full);
+    TEST_ASSERT_EQUAL_size_t(15, int_ring16_count(&ring));
+}
+
+void test_other_capacity_ring_pops_in_order()
+{
+    struct int_ring5 ring;
+    memset(&ring, 0, sizeof(ring));
+
+    int dropped;
+    for (int i = 0; i < 7; i++) {
+        int_ring5_push(&ring, &i, &dropped);
+    }
+    TEST_ASSERT_TRUE(ring.full);
+    TEST_ASSERT_EQUAL_UINT32(ring.in_offs, ring.out_offs);
+
+    for (int i = 2; i < 7; i++) {
+        TEST_ASSERT_EQUAL_INT(i, int_ring5_pop(&ring));
+    }
+    TEST_ASSERT_EQUAL_size_t(0, int_ring5_count(&ring));
+}
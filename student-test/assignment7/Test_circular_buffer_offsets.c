@@ -0,0 +1,254 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+static void add_string(struct aesd_circular_buffer *buffer, const char *str)
+{
+    struct aesd_buffer_entry entry = {.buffptr = str, .size = strlen(str)};
+    aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+void test_find_entry_after_wraparound()
+{
+    static char strings[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 3][8];
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        snprintf(strings[i], sizeof(strings[i]), "%zu\n", i);
+        add_string(&buffer, strings[i]);
+    }
+
+    // the buffer holds entries 20..29, each 3 bytes long
+    size_t offset;
+    struct aesd_buffer_entry *entry;
+    for (size_t pos = 0; pos < 30; pos++) {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, pos, &offset);
+        TEST_ASSERT_NOT_NULL_MESSAGE(entry, "offset inside the buffer should be found");
+        TEST_ASSERT_EQUAL_PTR(strings[20 + pos / 3], entry->buffptr);
+        TEST_ASSERT_EQUAL_size_t(pos % 3, offset);
+    }
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 30, &offset));
+}
+
+void test_find_fpos_for_entry()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+
+    add_string(&buffer, "a\n");
+    add_string(&buffer, "");
+    add_string(&buffer, "bcd\n");
+
+    size_t offset;
+    TEST_ASSERT_EQUAL_UINT(3, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_NOT_NULL(aesd_circular_buffer_find_fpos_for_entry(&buffer, 2, &offset));
+    TEST_ASSERT_EQUAL_size_t(2, offset);
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_fpos_for_entry(&buffer, 3, &offset));
+
+    // an empty entry never holds an offset
+    struct aesd_buffer_entry *entry =
+        aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 2, &offset);
+    TEST_ASSERT_EQUAL_STRING_LEN("bcd\n", entry->buffptr, 4);
+    TEST_ASSERT_EQUAL_size_t(0, offset);
+}
+
+void test_offsets_and_sequence_numbers_are_monotonic()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+
+    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; i++) {
+        add_string(&buffer, "ab\n");
+    }
+
+    // the two oldest entries, bytes 0..5, were overwritten
+    size_t offset;
+    TEST_ASSERT_EQUAL_UINT64(2, aesd_circular_buffer_first_seq(&buffer));
+    TEST_ASSERT_EQUAL_UINT64(6, aesd_circular_buffer_first_offset(&buffer));
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_for_offset(&buffer, 5, &offset));
+
+    struct aesd_buffer_entry *entry =
+        aesd_circular_buffer_find_entry_for_offset(&buffer, 13, &offset);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_size_t(1, offset);
+    TEST_ASSERT_EQUAL_UINT64(4, aesd_circular_buffer_entry_seq(&buffer, entry));
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_for_offset(&buffer, 36, &offset));
+}
+
+void test_byte_budget_evicts_oldest_entries()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    static const char small[] = "abc\n";
+    static char large[14];
+    aesd_circular_buffer_init(&buffer);
+    aesd_circular_buffer_set_max_size(&buffer, 16);
+
+    struct aesd_buffer_entry entry = {.buffptr = small, .size = 4};
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_size_t(0, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted));
+    }
+    TEST_ASSERT_EQUAL_size_t(16, buffer.size);
+
+    // one more small entry pushes out exactly the oldest one
+    TEST_ASSERT_EQUAL_size_t(1, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted));
+    TEST_ASSERT_EQUAL_PTR(small, evicted[0].buffptr);
+    TEST_ASSERT_EQUAL_UINT64(1, aesd_circular_buffer_first_seq(&buffer));
+
+    // a 14 byte entry leaves no room for any other
+    memset(large, 'x', sizeof(large) - 1);
+    large[sizeof(large) - 1] = '\n';
+    entry = (struct aesd_buffer_entry){.buffptr = large, .size = sizeof(large)};
+    TEST_ASSERT_EQUAL_size_t(4, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted));
+    TEST_ASSERT_EQUAL_size_t(1, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_size_t(sizeof(large), buffer.size);
+    TEST_ASSERT_EQUAL_UINT64(20, aesd_circular_buffer_first_offset(&buffer));
+
+    size_t offset;
+    TEST_ASSERT_EQUAL_PTR(large, aesd_circular_buffer_find_entry_for_offset(&buffer, 33, &offset)->buffptr);
+    TEST_ASSERT_EQUAL_size_t(13, offset);
+
+    // an entry over the budget on its own is still kept
+    aesd_circular_buffer_set_max_size(&buffer, 8);
+    TEST_ASSERT_EQUAL_size_t(1, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted));
+    TEST_ASSERT_EQUAL_size_t(1, aesd_circular_buffer_count(&buffer));
+}
+
+void test_entry_count_still_limits_without_budget()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry entry = {.buffptr = "a\n", .size = 2};
+    aesd_circular_buffer_init(&buffer);
+
+    size_t total = 0;
+    for (size_t i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3; i++) {
+        total += aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted);
+    }
+    TEST_ASSERT_EQUAL_size_t(3, total);
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_size_t(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                             aesd_circular_buffer_count(&buffer));
+}
+
+void test_iterate_and_copy_range_in_order_after_wraparound()
+{
+    static char strings[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 4][8];
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+
+    // entries 4..13 remain, each 3 bytes long, oldest stored in slot 4
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        snprintf(strings[i], sizeof(strings[i]), "%c%c\n", 'a' + (char)i, 'a' + (char)i);
+        add_string(&buffer, strings[i]);
+    }
+
+    size_t index;
+    struct aesd_buffer_entry *entry;
+    AESD_CIRCULAR_BUFFER_FOREACH_IN_ORDER(entry, &buffer, index) {
+        TEST_ASSERT_EQUAL_PTR(strings[4 + index], entry->buffptr);
+    }
+    TEST_ASSERT_EQUAL_size_t(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, index);
+
+    // from the middle of entry 8 across the slot wraparound to the end of entry 11
+    char out[64];
+    memset(out, 0, sizeof(out));
+    TEST_ASSERT_EQUAL_size_t(11, aesd_circular_buffer_copy_range(&buffer, 25, out, 11));
+    TEST_ASSERT_EQUAL_STRING("i\njj\nkk\nll\n", out);
+
+    // clamped to the newest byte
+    TEST_ASSERT_EQUAL_size_t(4, aesd_circular_buffer_copy_range(&buffer, 38, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY("\nnn\n", out, 4);
+
+    TEST_ASSERT_EQUAL_size_t(0, aesd_circular_buffer_copy_range(&buffer, 11, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_size_t(0, aesd_circular_buffer_copy_range(&buffer, 42, out, sizeof(out)));
+}
+
+void test_search_finds_matches_spanning_entries()
+{
+    static char strings[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2][8];
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+
+    // entries 2..11 remain, "e2\n" to "e11\n", the oldest stored in slot 2
+    size_t start = 0;
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        snprintf(strings[i], sizeof(strings[i]), "e%zu\n", i);
+        if (i < 2) {
+            start += strlen(strings[i]);
+        }
+        add_string(&buffer, strings[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT64(start, aesd_circular_buffer_first_offset(&buffer));
+
+    // "9\ne1" spans entries 9 and 10, across the slot wraparound
+    uint64_t offset = 0;
+    TEST_ASSERT_TRUE(aesd_circular_buffer_search(&buffer, &offset, "9\ne1", 4));
+    size_t entry_offset;
+    struct aesd_buffer_entry *entry =
+        aesd_circular_buffer_find_entry_for_offset(&buffer, offset, &entry_offset);
+    TEST_ASSERT_EQUAL_PTR(strings[9], entry->buffptr);
+    TEST_ASSERT_EQUAL_size_t(1, entry_offset);
+    TEST_ASSERT_EQUAL_UINT64(9, aesd_circular_buffer_entry_seq(&buffer, entry));
+
+    // the overwritten "e0\n" and "e1\n" are not searched, later matches are
+    offset = 0;
+    TEST_ASSERT_TRUE(aesd_circular_buffer_search(&buffer, &offset, "e1", 2));
+    TEST_ASSERT_EQUAL_PTR(strings[10],
+        aesd_circular_buffer_find_entry_for_offset(&buffer, offset, &entry_offset)->buffptr);
+    offset++;
+    TEST_ASSERT_TRUE(aesd_circular_buffer_search(&buffer, &offset, "e1", 2));
+    TEST_ASSERT_EQUAL_PTR(strings[11],
+        aesd_circular_buffer_find_entry_for_offset(&buffer, offset, &entry_offset)->buffptr);
+    offset++;
+    uint64_t const before = offset;
+    TEST_ASSERT_FALSE(aesd_circular_buffer_search(&buffer, &offset, "e1", 2));
+    TEST_ASSERT_EQUAL_UINT64(before, offset);
+
+    // the pattern may not run past the newest byte
+    offset = 0;
+    TEST_ASSERT_FALSE(aesd_circular_buffer_search(&buffer, &offset, "11\n\n", 4));
+}
+
+void test_entries_search_matches_long_records_and_their_boundaries()
+{
+    // long enough for whole blocks of candidate positions, with a common
+    // first byte in every record
+    static const char *records[] = {
+        "every event ends early, every entry else errs\n",
+        "eventually every event ends: ev",
+        "ent horizon reached by every event\n",
+    };
+    struct aesd_buffer_entry entry[3];
+    for (size_t i = 0; i < 3; i++) {
+        entry[i].buffptr = records[i];
+        entry[i].size = strlen(records[i]);
+    }
+    // the oldest record is stored last, as after a wraparound
+    struct aesd_buffer_entry ring[3] = {entry[1], entry[2], entry[0]};
+    struct aesd_buffer_entries const entries = {
+        .entry = ring, .capacity = 3, .first = 2, .count = 3};
+
+    size_t index = 0;
+    size_t entry_offset = 0;
+    TEST_ASSERT_TRUE(aesd_buffer_entries_search(&entries, &index, &entry_offset, "eventually", 10));
+    TEST_ASSERT_EQUAL_size_t(1, index);
+    TEST_ASSERT_EQUAL_size_t(0, entry_offset);
+
+    // "ev" ends record 1 and "ent horizon" starts record 2
+    TEST_ASSERT_TRUE(aesd_buffer_entries_search(&entries, &index, &entry_offset, "event horizon", 13));
+    TEST_ASSERT_EQUAL_size_t(1, index);
+    TEST_ASSERT_EQUAL_size_t(strlen(records[1]) - 2, entry_offset);
+
+    index = 2;
+    entry_offset = 0;
+    TEST_ASSERT_TRUE(aesd_buffer_entries_search(&entries, &index, &entry_offset, "every event\n", 12));
+    TEST_ASSERT_EQUAL_size_t(2, index);
+    TEST_ASSERT_EQUAL_size_t(strlen(records[2]) - 12, entry_offset);
+    entry_offset++;
+    TEST_ASSERT_FALSE(aesd_buffer_entries_search(&entries, &index, &entry_offset, "every event\n", 12));
+    TEST_ASSERT_EQUAL_size_t(2, index);
+    TEST_ASSERT_EQUAL_size_t(strlen(records[2]) - 11, entry_offset);
+}